@@ -21,9 +21,14 @@
  */
 
 #include "ds18b20.h"
+#include "ds18b20_private.h"
 
+#include "sdkconfig.h"
 #include "esp_check.h"
-#include "onewire_device.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "onewire_cmd.h"
 #include "onewire_crc.h"
 
@@ -32,11 +37,20 @@
 #define DS18B20_CMD_CONVERT_TEMP 0x44
 #define DS18B20_CMD_WRITE_SCRATCHPAD 0x4E
 #define DS18B20_CMD_READ_SCRATCHPAD 0xBE
+#define DS18B20_CMD_COPY_SCRATCHPAD 0x48
+#define DS18B20_CMD_READ_POWER_SUPPLY 0xB4
+
+#define DS18B20_EEPROM_WRITE_TIME_MS 10
+
+#define DS18B20_POWER_ON_RESERVED2 0x0C // scratchpad byte 6 after power-on, a conversion sets 0x10 - (temp_lsb & 0x0F)
 
 namespace ds18b20
 {
     static const char *TAG = "ds18b20";
 
+    static bus_context_t bus_contexts[CONFIG_DS18B20_MAX_BUSES];
+    static portMUX_TYPE bus_contexts_lock = portMUX_INITIALIZER_UNLOCKED; // slots are claimed from tasks on any core
+
     typedef struct  {
         uint8_t temp_lsb; /*!< lsb of temperature */
         uint8_t temp_msb; /*!< msb of temperature */
@@ -49,6 +63,513 @@ namespace ds18b20
         uint8_t crc_value; /*!< crc value of scratchpad data */
     } scratchpad_t;
 
+    bus_context_t* get_bus_context(onewire_bus_handle_t handle)
+    {
+        if (!handle) return NULL;
+        for (size_t i = 0; i < CONFIG_DS18B20_MAX_BUSES; i++) {
+            // the handle is stored last when a slot is claimed, a slot found here is fully initialized
+            if (__atomic_load_n(&bus_contexts[i].handle, __ATOMIC_ACQUIRE) == handle) return &bus_contexts[i];
+        }
+        return NULL;
+    }
+
+    /// @brief Take a reference to the slot of a bus, claiming a free slot on the first one
+    /// @param handle OneWire bus handle
+    /// @return Bus context or NULL if there are no free slots
+    static bus_context_t* acquire_bus_context(onewire_bus_handle_t handle)
+    {
+        portENTER_CRITICAL(&bus_contexts_lock);
+        bus_context_t* bus = get_bus_context(handle);
+        if (!bus) {
+            for (size_t i = 0; i < CONFIG_DS18B20_MAX_BUSES && !bus; i++) {
+                if (!bus_contexts[i].handle) bus = &bus_contexts[i];
+            }
+            if (bus) {
+                memset(bus, 0, sizeof(bus_context_t));
+                portMUX_INITIALIZE(&bus->stats_lock);
+                __atomic_store_n(&bus->handle, handle, __ATOMIC_RELEASE);
+            }
+        }
+        if (bus) bus->users++;
+        portEXIT_CRITICAL(&bus_contexts_lock);
+        return bus;
+    }
+
+    /// @brief Drop a reference to the slot of a bus, the last one frees the slot
+    /// @param bus Bus context
+    static void release_bus_context(bus_context_t* bus)
+    {
+        portENTER_CRITICAL(&bus_contexts_lock);
+        bool last = bus->users && --bus->users == 0;
+        portEXIT_CRITICAL(&bus_contexts_lock);
+        if (!last) return;
+
+        if (bus->lock) vSemaphoreDelete(bus->lock);
+        __atomic_store_n(&bus->handle, static_cast<onewire_bus_handle_t>(NULL), __ATOMIC_RELEASE);
+    }
+
+    /// @brief Take a per-bus slot for settings and statistics
+    /// @param handle OneWire bus handle
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if handle is NULL, ESP_ERR_NO_MEM if there are no free bus slots
+    esp_err_t register_bus(onewire_bus_handle_t handle)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+        DS18B20_RETURN_ON_FALSE(acquire_bus_context(handle), ESP_ERR_NO_MEM, TAG, "no free bus slots, increase CONFIG_DS18B20_MAX_BUSES");
+
+        return ESP_OK;
+    }
+
+    /// @brief Release a per-bus slot taken with register_bus() or enable_bus_lock()
+    /// @param handle OneWire bus handle
+    void unregister_bus(onewire_bus_handle_t handle)
+    {
+        bus_context_t* bus = get_bus_context(handle);
+        if (bus) release_bus_context(bus);
+    }
+
+    bool has_strong_pullup(onewire_bus_handle_t handle)
+    {
+        bus_context_t* ctx = get_bus_context(handle);
+        return ctx && ctx->strong_pullup;
+    }
+
+    esp_err_t strong_pullup(onewire_bus_handle_t handle, bool enable)
+    {
+        bus_context_t* ctx = get_bus_context(handle);
+        if (!ctx || !ctx->strong_pullup) return ESP_ERR_NOT_SUPPORTED;
+        return ctx->strong_pullup(handle, enable, ctx->strong_pullup_ctx);
+    }
+
+    void count_error(onewire_bus_handle_t handle, esp_err_t err)
+    {
+        bus_context_t* ctx = get_bus_context(handle);
+        if (!ctx) return;
+        portENTER_CRITICAL(&ctx->stats_lock);
+        switch (err) {
+        case ESP_ERR_NOT_FOUND: ctx->stats.presence_errors++; break;
+        case ESP_ERR_INVALID_CRC: ctx->stats.crc_errors++; break;
+        case ESP_ERR_TIMEOUT: ctx->stats.timeouts++; break;
+        default: ctx->stats.bus_errors++; break;
+        }
+        portEXIT_CRITICAL(&ctx->stats_lock);
+    }
+
+    /// @brief Run a bus primitive, count its error and, with CONFIG_DS18B20_BUS_STATS, count and time the call
+    /// @param handle OneWire bus handle
+    /// @param op Operation statistics in stats_t
+    /// @param call Primitive
+    /// @return Result of call
+    template <typename F>
+    static inline esp_err_t bus_call(onewire_bus_handle_t handle, op_stats_t stats_t::* op, F call)
+    {
+#if CONFIG_DS18B20_BUS_STATS
+        int64_t start = esp_timer_get_time();
+        esp_err_t err = call();
+        int64_t elapsed = esp_timer_get_time() - start;
+        bus_context_t* ctx = get_bus_context(handle);
+        if (ctx) {
+            portENTER_CRITICAL(&ctx->stats_lock);
+            (ctx->stats.*op).count++;
+            (ctx->stats.*op).time_us += elapsed;
+            portEXIT_CRITICAL(&ctx->stats_lock);
+        }
+#else
+        (void)op;
+        esp_err_t err = call();
+#endif
+        if (unlikely(err != ESP_OK)) count_error(handle, err);
+        return err;
+    }
+
+    esp_err_t bus_reset(onewire_bus_handle_t handle)
+    {
+        return bus_call(handle, &stats_t::reset, [=] { return onewire_bus_reset(handle); });
+    }
+
+    esp_err_t bus_write_bytes(onewire_bus_handle_t handle, const uint8_t* tx_data, uint8_t tx_data_size)
+    {
+        return bus_call(handle, &stats_t::write_bytes, [=] { return onewire_bus_write_bytes(handle, tx_data, tx_data_size); });
+    }
+
+    esp_err_t bus_read_bytes(onewire_bus_handle_t handle, uint8_t* rx_buf, size_t rx_buf_size)
+    {
+        return bus_call(handle, &stats_t::read_bytes, [=] { return onewire_bus_read_bytes(handle, rx_buf, rx_buf_size); });
+    }
+
+    esp_err_t bus_write_bit(onewire_bus_handle_t handle, uint8_t tx_bit)
+    {
+        return bus_call(handle, &stats_t::write_bit, [=] { return onewire_bus_write_bit(handle, tx_bit); });
+    }
+
+    esp_err_t bus_read_bit(onewire_bus_handle_t handle, uint8_t* rx_bit)
+    {
+        return bus_call(handle, &stats_t::read_bit, [=] { return onewire_bus_read_bit(handle, rx_bit); });
+    }
+
+    /// @brief Get error counters and bus statistics
+    /// @param handle OneWire bus handle
+    /// @param stats Counters output buffer
+    /// @param reset Clear counters after reading
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if handle or stats is NULL
+    esp_err_t get_stats(onewire_bus_handle_t handle, stats_t* stats, bool reset)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+        DS18B20_RETURN_ON_FALSE(stats, ESP_ERR_INVALID_ARG, TAG, "invalid stats pointer");
+
+        bus_context_t* ctx = get_bus_context(handle);
+        if (!ctx) {
+            memset(stats, 0, sizeof(stats_t));
+            return ESP_OK;
+        }
+        portENTER_CRITICAL(&ctx->stats_lock);
+        *stats = ctx->stats;
+        if (reset) memset(&ctx->stats, 0, sizeof(stats_t));
+        portEXIT_CRITICAL(&ctx->stats_lock);
+
+        return ESP_OK;
+    }
+
+    esp_err_t write_with_pullup(onewire_bus_handle_t handle, const uint8_t* tx_data, uint8_t tx_data_size, bool* engaged)
+    {
+        *engaged = false;
+        bus_context_t* ctx = get_bus_context(handle);
+        if (ctx && ctx->strong_pullup && ctx->strong_pullup_armed && tx_data_size) {
+            // the master engages the pull-up after the next write, arm it right before the last (command) byte
+            esp_err_t err = tx_data_size > 1 ? bus_write_bytes(handle, tx_data, tx_data_size - 1) : ESP_OK;
+            if (err != ESP_OK) return err;
+            *engaged = ctx->strong_pullup(handle, true, ctx->strong_pullup_ctx) == ESP_OK;
+            err = bus_write_bytes(handle, &tx_data[tx_data_size - 1], 1);
+            if (err != ESP_OK && *engaged) {
+                ctx->strong_pullup(handle, false, ctx->strong_pullup_ctx);
+                *engaged = false;
+            }
+            return err;
+        }
+
+        esp_err_t err = bus_write_bytes(handle, tx_data, tx_data_size);
+        if (err == ESP_OK && ctx && ctx->strong_pullup) *engaged = ctx->strong_pullup(handle, true, ctx->strong_pullup_ctx) == ESP_OK;
+        return err;
+    }
+
+    /// @brief Register strong pull-up control for a bus
+    /// @param handle OneWire bus handle
+    /// @param callback Strong pull-up control (or NULL to unregister)
+    /// @param ctx Callback context
+    /// @param arm_before_write Callback is asked to enable the pull-up before the command write
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if handle is NULL, ESP_ERR_NO_MEM if there are no free bus slots
+    esp_err_t set_strong_pullup(onewire_bus_handle_t handle, strong_pullup_t callback, void* ctx, bool arm_before_write)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+
+        bus_context_t* bus = get_bus_context(handle);
+        bool installed = bus && bus->strong_pullup;
+        if (callback && !installed) { // a registered callback holds a reference to the slot
+            bus = acquire_bus_context(handle);
+            DS18B20_RETURN_ON_FALSE(bus, ESP_ERR_NO_MEM, TAG, "no free bus slots, increase CONFIG_DS18B20_MAX_BUSES");
+        }
+        if (!bus) return ESP_OK;
+        bus->strong_pullup = callback;
+        bus->strong_pullup_ctx = ctx;
+        bus->strong_pullup_armed = arm_before_write;
+        if (!callback && installed) release_bus_context(bus);
+
+        return ESP_OK;
+    }
+
+    /// @brief Register a hardware search triplet for a bus
+    /// @param handle OneWire bus handle
+    /// @param callback Search triplet (or NULL to unregister)
+    /// @param ctx Callback context
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if handle is NULL, ESP_ERR_NO_MEM if there are no free bus slots
+    esp_err_t set_search_triplet(onewire_bus_handle_t handle, search_triplet_t callback, void* ctx)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+
+        bus_context_t* bus = get_bus_context(handle);
+        bool installed = bus && bus->search_triplet;
+        if (callback && !installed) { // a registered callback holds a reference to the slot
+            bus = acquire_bus_context(handle);
+            DS18B20_RETURN_ON_FALSE(bus, ESP_ERR_NO_MEM, TAG, "no free bus slots, increase CONFIG_DS18B20_MAX_BUSES");
+        }
+        if (!bus) return ESP_OK;
+        bus->search_triplet = callback;
+        bus->search_triplet_ctx = ctx;
+        if (!callback && installed) release_bus_context(bus);
+
+        return ESP_OK;
+    }
+
+    /// @brief Register a bus and create its transaction lock
+    /// @param handle OneWire bus handle
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if handle is NULL, ESP_ERR_NO_MEM if there are no free bus slots
+    esp_err_t enable_bus_lock(onewire_bus_handle_t handle)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+
+        bus_context_t* bus = acquire_bus_context(handle);
+        DS18B20_RETURN_ON_FALSE(bus, ESP_ERR_NO_MEM, TAG, "no free bus slots, increase CONFIG_DS18B20_MAX_BUSES");
+        if (!bus->lock) bus->lock = xSemaphoreCreateRecursiveMutexStatic(&bus->lock_buffer);
+
+        return ESP_OK;
+    }
+
+    /// @brief Take the transaction lock of a bus for a sequence of transactions
+    /// @param handle OneWire bus handle
+    /// @param timeout_ms Maximum time to wait (UINT32_MAX to wait forever)
+    /// @return ESP_OK if taken or the bus has no lock, ESP_ERR_INVALID_ARG if handle is NULL, ESP_ERR_TIMEOUT if the bus stayed busy
+    esp_err_t lock_bus(onewire_bus_handle_t handle, uint32_t timeout_ms)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+
+        const bus_context_t* bus = get_bus_context(handle);
+        if (!bus || !bus->lock) return ESP_OK;
+        TickType_t ticks = timeout_ms == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+        return xSemaphoreTakeRecursive(bus->lock, ticks) == pdTRUE ? ESP_OK : ESP_ERR_TIMEOUT;
+    }
+
+    /// @brief Release the transaction lock of a bus
+    /// @param handle OneWire bus handle
+    void unlock_bus(onewire_bus_handle_t handle)
+    {
+        const bus_context_t* bus = get_bus_context(handle);
+        if (bus && bus->lock) xSemaphoreGiveRecursive(bus->lock);
+    }
+
+    BusLock::BusLock(onewire_bus_handle_t handle)
+    {
+        const bus_context_t* bus = get_bus_context(handle);
+        mutex = bus ? bus->lock : NULL;
+        if (mutex) xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+    }
+
+    BusLock::~BusLock()
+    {
+        if (mutex) xSemaphoreGiveRecursive(mutex);
+    }
+
+#if CONFIG_DS18B20_CRC8_TABLE
+    /// @brief Build the byte-wise lookup table of the Dallas/Maxim CRC8 (x^8 + x^5 + x^4 + 1, reflected 0x8C) at compile time
+    struct crc8_table_t {
+        uint8_t entries[256];
+        constexpr crc8_table_t() : entries()
+        {
+            for (unsigned i = 0; i < 256; i++) {
+                uint8_t crc = i;
+                for (int bit = 0; bit < 8; bit++) crc = (crc & 0x01) ? (crc >> 1) ^ 0x8C : (crc >> 1);
+                entries[i] = crc;
+            }
+        }
+    };
+    DRAM_ATTR static const crc8_table_t crc8_table; // DRAM: no flash cache misses on the hot path
+#elif CONFIG_DS18B20_CRC8_NIBBLE
+    /// @brief CRC8 of the low and high nibble separately, the CRC is linear so a byte is the XOR of both
+    DRAM_ATTR static const uint8_t crc8_low_nibble[16] = {
+        0x00, 0x5E, 0xBC, 0xE2, 0x61, 0x3F, 0xDD, 0x83, 0xC2, 0x9C, 0x7E, 0x20, 0xA3, 0xFD, 0x1F, 0x41
+    };
+    DRAM_ATTR static const uint8_t crc8_high_nibble[16] = {
+        0x00, 0x9D, 0x23, 0xBE, 0x46, 0xDB, 0x65, 0xF8, 0x8C, 0x11, 0xAF, 0x32, 0xCA, 0x57, 0xE9, 0x74
+    };
+#endif
+
+    /// @brief Dallas/Maxim CRC8, implementation is selected by CONFIG_DS18B20_CRC8_*
+    /// @param data Data
+    /// @param len Data length
+    /// @return CRC
+    uint8_t crc8(const uint8_t* data, size_t len)
+    {
+#if CONFIG_DS18B20_CRC8_TABLE
+        uint8_t crc = 0;
+        while (len--) crc = crc8_table.entries[crc ^ *data++];
+        return crc;
+#elif CONFIG_DS18B20_CRC8_NIBBLE
+        uint8_t crc = 0;
+        while (len--) {
+            uint8_t x = crc ^ *data++;
+            crc = crc8_low_nibble[x & 0x0F] ^ crc8_high_nibble[x >> 4];
+        }
+        return crc;
+#else
+        return onewire_crc8(0, const_cast<uint8_t*>(data), len);
+#endif
+    }
+
+    /// @brief Check CRC of several equally sized blocks that end with their CRC byte
+    /// @param blocks Blocks, back to back
+    /// @param block_size Block size including CRC byte
+    /// @param count Number of blocks
+    /// @param valid Per-block result output buffer
+    /// @return Number of blocks with CRC mismatch
+    size_t crc8_check(const uint8_t* blocks, size_t block_size, size_t count, bool* valid)
+    {
+        size_t failed = 0;
+        for (size_t i = 0; i < count; i++, blocks += block_size) {
+            valid[i] = crc8(blocks, block_size - 1) == blocks[block_size - 1];
+            if (!valid[i]) failed++;
+        }
+        return failed;
+    }
+
+    /// @brief Get datasheet maximum conversion time: 750ms for 12 bits, halved for every bit less
+    /// @param resolution Resolution
+    /// @param family Family code
+    /// @return Conversion time, us
+    uint32_t get_conversion_time_us(resolution_t resolution, uint8_t family)
+    {
+        if (family == FAMILY_DS18S20) return 750000;
+        switch (resolution) {
+        case RESOLUTION_9B: return 93750;
+        case RESOLUTION_10B: return 187500;
+        case RESOLUTION_11B: return 375000;
+        default: return 750000;
+        }
+    }
+
+    bool is_supported_family(uint8_t family)
+    {
+        return family == FAMILY_DS18S20 || family == FAMILY_DS1822 || family == FAMILY_DS18B20;
+    }
+
+    /// @brief Get the family of the addressed device
+    /// @param rom_number Device ROM ID (or NULL for SKIP ROM)
+    /// @return Family code, DS18B20 for SKIP ROM
+    static uint8_t family_of(const onewire_device_address_t* rom_number)
+    {
+        return rom_number ? get_family(*rom_number) : static_cast<uint8_t>(FAMILY_DS18B20);
+    }
+
+    /// @brief Convert scratchpad temperature registers, bits undefined in low resolution modes are masked
+    /// @param scratchpad Scratchpad
+    /// @param family Family code of the device
+    /// @param length Number of scratchpad bytes read, a DS18S20 needs the full scratchpad for the extended resolution
+    /// @return Temperature, 1/16 degrees C
+    static int16_t decode_raw(const scratchpad_t& scratchpad, uint8_t family, read_length_t length = READ_FULL)
+    {
+        if (family == FAMILY_DS18S20) {
+            // 0.5 degrees C register, extended: truncate the half bit, - 0.25 + (COUNT_PER_C - COUNT_REMAIN) / COUNT_PER_C
+            int16_t half = static_cast<int16_t>((static_cast<uint16_t>(scratchpad.temp_msb) << 8) | scratchpad.temp_lsb);
+            uint8_t count_remain = scratchpad._reserved2;
+            uint8_t count_per_c = scratchpad._reserved3;
+            if (length != READ_FULL || count_per_c == 0 || count_remain > count_per_c) return static_cast<int16_t>(half * 8);
+            return static_cast<int16_t>((half & ~1) * 8 - 4 + ((count_per_c - count_remain) * 16) / count_per_c);
+        }
+        static const uint8_t lsb_mask[4] = { 0x07, 0x03, 0x01, 0x00 };
+        uint8_t lsb_masked = scratchpad.temp_lsb & (~lsb_mask[(scratchpad.configuration >> 5) & 0x03]); // mask bits not used in low resolution
+        return static_cast<int16_t>((static_cast<uint16_t>(scratchpad.temp_msb) << 8) | lsb_masked);
+    }
+
+    /// @brief Reset the bus and address a device (MATCH ROM) or every device (SKIP ROM) with a function command, the caller holds the bus lock
+    /// @param handle OneWire bus handle
+    /// @param rom_number Device ROM ID (or NULL to SKIP ROM)
+    /// @param command Function command
+    /// @param data Bytes written after the command in the same write (can be NULL)
+    /// @param data_size Number of data bytes, at most 3
+    /// @param engaged Engage the strong pull-up right after the write and report whether it is on (NULL to write normally)
+    /// @return ESP_OK if succeeded, otherwise see onewire_bus_reset, onewire_bus_write_bytes
+    static esp_err_t select(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, uint8_t command,
+        const uint8_t* data = NULL, uint8_t data_size = 0, bool* engaged = NULL)
+    {
+        uint8_t tx_buffer[13];
+        uint8_t tx_buffer_size = 0;
+
+        if (rom_number) { // specify rom id
+            tx_buffer[tx_buffer_size++] = ONEWIRE_CMD_MATCH_ROM;
+            memcpy(&tx_buffer[tx_buffer_size], rom_number, sizeof(onewire_device_address_t));
+            tx_buffer_size += sizeof(onewire_device_address_t);
+        } else { // skip rom id
+            tx_buffer[tx_buffer_size++] = ONEWIRE_CMD_SKIP_ROM;
+        }
+        tx_buffer[tx_buffer_size++] = command;
+        if (data_size) {
+            memcpy(&tx_buffer[tx_buffer_size], data, data_size);
+            tx_buffer_size += data_size;
+        }
+
+        esp_err_t err = bus_reset(handle); // reset bus and check if the device is present
+        if (err != ESP_OK) return err;
+        if (engaged) return write_with_pullup(handle, tx_buffer, tx_buffer_size, engaged);
+        return bus_write_bytes(handle, tx_buffer, tx_buffer_size);
+    }
+
+    /// @brief Receive the scratchpad after a Read Scratchpad command and check CRC
+    /// @param handle OneWire bus handle
+    /// @param scratchpad Output buffer
+    /// @param length Number of bytes to read, CRC is checked only for a full read
+    /// @param verify Check CRC of a full read (false if the caller checks it later)
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_CRC if CRC doesn't match, otherwise see onewire_bus_read_bytes
+    static esp_err_t receive_scratchpad(onewire_bus_handle_t handle, scratchpad_t* scratchpad, read_length_t length, bool verify)
+    {
+        // a shorter read is terminated by the reset that starts the next transaction
+        esp_err_t err = bus_read_bytes(handle, reinterpret_cast<uint8_t*>(scratchpad), length);
+        if (err != ESP_OK) return err;
+        if (verify && length == READ_FULL && crc8(reinterpret_cast<const uint8_t*>(scratchpad), 8) != scratchpad->crc_value) {
+            count_error(handle, ESP_ERR_INVALID_CRC);
+            return ESP_ERR_INVALID_CRC;
+        }
+        return ESP_OK;
+    }
+
+    /// @brief Reset the bus, send a prepared ROM + Read Scratchpad command and check CRC. Silent, for batch operations.
+    /// @param handle OneWire bus handle
+    /// @param tx_buffer Prepared ROM and function command, e.g. the batch template with the ROM bytes patched per device
+    /// @param tx_buffer_size Command length
+    /// @param scratchpad Output buffer
+    /// @param length Number of bytes to read, CRC is checked only for a full read
+    /// @param verify Check CRC of a full read (false if the caller checks it later)
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_CRC if CRC doesn't match, otherwise see onewire_bus_reset, onewire_bus_write_bytes, onewire_bus_read_bytes
+    static esp_err_t read_scratchpad(onewire_bus_handle_t handle, const uint8_t* tx_buffer, uint8_t tx_buffer_size, scratchpad_t* scratchpad,
+        read_length_t length = READ_FULL, bool verify = true)
+    {
+        BusLock lock(handle);
+        count_transaction(handle, &stats_t::scratchpad_reads);
+        esp_err_t err = bus_reset(handle);
+        if (err != ESP_OK) return err;
+        err = bus_write_bytes(handle, tx_buffer, tx_buffer_size);
+        if (err != ESP_OK) return err;
+        return receive_scratchpad(handle, scratchpad, length, verify);
+    }
+
+    /// @brief Address a device, send Read Scratchpad and check CRC. Silent, the caller logs.
+    /// @param handle OneWire bus handle
+    /// @param rom_number Device ROM ID (or NULL to SKIP ROM)
+    /// @param scratchpad Output buffer
+    /// @param length Number of bytes to read, CRC is checked only for a full read
+    /// @param verify Check CRC of a full read (false if the caller checks it later)
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_CRC if CRC doesn't match, otherwise see onewire_bus_reset, onewire_bus_write_bytes, onewire_bus_read_bytes
+    static esp_err_t read_scratchpad(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, scratchpad_t* scratchpad,
+        read_length_t length = READ_FULL, bool verify = true)
+    {
+        BusLock lock(handle);
+        count_transaction(handle, &stats_t::scratchpad_reads);
+        esp_err_t err = select(handle, rom_number, DS18B20_CMD_READ_SCRATCHPAD);
+        if (err != ESP_OK) return err;
+        return receive_scratchpad(handle, scratchpad, length, verify);
+    }
+
+    /// @brief Run search passes until the buffer is full or there are no more devices
+    /// @param handle OneWire bus handle
+    /// @param command ROM search command
+    /// @param rom_id_buffer Pointer to the buffer for writing ROM IDs
+    /// @param max_instances Maximum number devices to look for
+    /// @param found Number of devices found
+    /// @return ESP_OK if succeeded (including no devices), otherwise see search_next
+    static esp_err_t search_all(onewire_bus_handle_t handle, uint8_t command, onewire_device_address_t* rom_id_buffer,
+        size_t max_instances, size_t* found)
+    {
+        search_context_t context;
+        search_begin(&context, command);
+        *found = 0;
+        while (*found < max_instances) {
+            esp_err_t err = search_next(handle, &context, &rom_id_buffer[*found]);
+            if (err == ESP_ERR_NOT_FOUND) break; // no (more) devices
+            if (err != ESP_OK) return err;
+            DS18B20_LOGD(TAG, "found device with rom id %" PRIu64, rom_id_buffer[*found]);
+            (*found)++;
+            if (context.last_device) break;
+        }
+
+        return ESP_OK;
+    }
+
     /// @brief Search 1-Wire bus for devices.
     /// @param handle OneWire bus handle
     /// @param rom_id_buffer Pointer to the buffer for writing ROM IDs
@@ -56,44 +577,148 @@ namespace ds18b20
     /// @return Actual number of devices found
     uint8_t search(onewire_bus_handle_t handle, onewire_device_address_t* rom_id_buffer, uint8_t max_instances)
     {
+        size_t found = 0;
+        esp_err_t err = search(handle, rom_id_buffer, max_instances, &found);
+        if (err != ESP_OK) DS18B20_LOGE(TAG, "Onewire search err: %s", esp_err_to_name(err));
+        DS18B20_LOGI(TAG, "%u device%s found on 1-wire bus", static_cast<unsigned>(found), found > 1 ? "s" : "");
+
+        return found;
+    }
+
+    /// @brief Search 1-Wire bus for devices without heap allocation
+    /// @param handle OneWire bus handle
+    /// @param rom_id_buffer Pointer to the buffer for writing ROM IDs
+    /// @param max_instances Maximum number devices to look for
+    /// @param found Number of devices found
+    /// @return ESP_OK if succeeded (including no devices), ESP_ERR_INVALID_ARG if any pointer is NULL, otherwise see search_next
+    esp_err_t search(onewire_bus_handle_t handle, onewire_device_address_t* rom_id_buffer, size_t max_instances, size_t* found)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+        DS18B20_RETURN_ON_FALSE(rom_id_buffer && found, ESP_ERR_INVALID_ARG, TAG, "invalid buffer pointer");
         static_assert(sizeof(onewire_device_address_t) == 8);
 
-        // create 1-wire rom search context
-        onewire_device_iter_handle_t context_handler;
-        ESP_ERROR_CHECK(onewire_new_device_iter(handle, &context_handler));
-
-        uint8_t device_num = 0;
-        onewire_device_t instance;
-        // search for devices on the bus
-        do {
-            esp_err_t search_result = onewire_device_iter_get_next(context_handler, &instance);
-            if (search_result != ESP_OK) 
-            {
-                if (search_result == ESP_ERR_NOT_FOUND) break;
-                ESP_LOGE(TAG, "Onewire search err: %s", esp_err_to_name(search_result));
-                break;
-            } // break on finish or no device
-            rom_id_buffer[device_num] = instance.address;
-            ESP_LOGI(TAG, "found device with rom id %" PRIu64, rom_id_buffer[device_num]);
-            device_num++;
-        } while (device_num < max_instances);
-
-        // delete 1-wire rom search context
-        ESP_ERROR_CHECK(onewire_del_device_iter(context_handler));
-        ESP_LOGI(TAG, "%" PRIu8 " device%s found on 1-wire bus", device_num, device_num > 1 ? "s" : "");
-
-        return device_num;
+        DS18B20_RETURN_ON_ERROR(search_all(handle, ONEWIRE_CMD_SEARCH_NORMAL, rom_id_buffer, max_instances, found),
+                            TAG, "search error");
+
+        return ESP_OK;
+    }
+
+    void search_begin(search_context_t* state, uint8_t command)
+    {
+        memset(state->rom, 0, sizeof(state->rom));
+        state->last_discrepancy = 0;
+        state->last_device = false;
+        state->command = command;
+    }
+
+    /// @brief Read a bit and its complement, then write the direction taken
+    /// @param handle OneWire bus handle
+    /// @param preferred Direction to take if both 0 and 1 are present
+    /// @param id_bit Bit read
+    /// @param cmp_id_bit Complement read
+    /// @param taken Direction written
+    /// @param bus Bus context with the hardware triplet, NULL to use separate time slots
+    /// @return ESP_OK if succeeded, otherwise see onewire_bus_read_bit, onewire_bus_write_bit
+    static esp_err_t search_triplet(onewire_bus_handle_t handle, uint8_t preferred, uint8_t* id_bit, uint8_t* cmp_id_bit, uint8_t* taken,
+        const bus_context_t* bus)
+    {
+        if (bus) {
+            esp_err_t err = bus->search_triplet(handle, preferred, id_bit, cmp_id_bit, taken, bus->search_triplet_ctx);
+            if (unlikely(err != ESP_OK)) count_error(handle, err);
+            return err;
+        }
+
+        esp_err_t err = bus_read_bit(handle, id_bit);
+        if (err != ESP_OK) return err;
+        err = bus_read_bit(handle, cmp_id_bit);
+        if (err != ESP_OK) return err;
+        if (*id_bit && *cmp_id_bit) return ESP_OK; // nobody answered, nothing to write
+        *taken = (*id_bit != *cmp_id_bit) ? *id_bit : preferred;
+        return bus_write_bit(handle, *taken);
+    }
+
+    /// @brief One pass of the ROM search, see Maxim application note 187
+    /// @param handle OneWire bus handle
+    /// @param state Search state
+    /// @param address Found ROM output buffer
+    /// @return ESP_OK if a device was found, ESP_ERR_NOT_FOUND if there are no (more) devices,
+    /// ESP_ERR_INVALID_CRC if the ROM is corrupt, otherwise see onewire_bus_reset, onewire_bus_read_bit, onewire_bus_write_bit
+    esp_err_t search_next(onewire_bus_handle_t handle, search_context_t* state, onewire_device_address_t* address)
+    {
+        if (state->last_device) {
+            search_begin(state, state->command);
+            return ESP_ERR_NOT_FOUND;
+        }
+
+        BusLock lock(handle); // a pass is one transaction, other tasks can take the bus between passes
+        count_transaction(handle, &stats_t::search_passes);
+        esp_err_t err = bus_reset(handle);
+        if (err != ESP_OK) { // ESP_ERR_NOT_FOUND if there's no device on the bus
+            search_begin(state, state->command);
+            return err;
+        }
+        err = bus_write_bytes(handle, &state->command, 1);
+        if (err != ESP_OK) return err;
+
+        const bus_context_t* bus = get_bus_context(handle);
+        if (bus && !bus->search_triplet) bus = NULL;
+        uint8_t last_zero = 0;
+        for (uint8_t bit = 1; bit <= 64; bit++) {
+            uint8_t& rom_byte = state->rom[(bit - 1) / 8];
+            uint8_t mask = 1 << ((bit - 1) % 8);
+            // at discrepancies: repeat the previous pass before the last discrepancy, take 1 at it, 0 after it
+            uint8_t preferred = bit < state->last_discrepancy ? ((rom_byte & mask) != 0) : (bit == state->last_discrepancy);
+            uint8_t id_bit, cmp_id_bit, taken = 0;
+            err = search_triplet(handle, preferred, &id_bit, &cmp_id_bit, &taken, bus);
+            if (err != ESP_OK) return err;
+            if (id_bit && cmp_id_bit) { // no devices participating (e.g. no alarmed devices)
+                search_begin(state, state->command);
+                return ESP_ERR_NOT_FOUND;
+            }
+            if (!id_bit && !cmp_id_bit && !taken) last_zero = bit;
+            if (taken) rom_byte |= mask;
+            else rom_byte &= ~mask;
+        }
+
+        if (crc8(state->rom, 7) != state->rom[7]) {
+            count_error(handle, ESP_ERR_INVALID_CRC);
+            search_begin(state, state->command);
+            return ESP_ERR_INVALID_CRC;
+        }
+
+        state->last_discrepancy = last_zero;
+        state->last_device = last_zero == 0;
+        memcpy(address, state->rom, sizeof(onewire_device_address_t));
+
+        return ESP_OK;
+    }
+
+    esp_err_t verify(onewire_bus_handle_t handle, onewire_device_address_t address)
+    {
+        search_context_t state;
+        search_begin(&state, ONEWIRE_CMD_SEARCH_NORMAL);
+        memcpy(state.rom, &address, sizeof(state.rom));
+        state.last_discrepancy = 64; // follow the ROM at every discrepancy
+
+        onewire_device_address_t found;
+        esp_err_t err = search_next(handle, &state, &found);
+        if (err != ESP_OK) return err;
+
+        return found == address ? ESP_OK : ESP_ERR_NOT_FOUND;
     }
 
     /// @brief Trigger DS18B20 temperature conversion
     /// @param handle OneWire bus handle
     /// @param rom_number Device ROM ID (or NULL to broadcast)
+    /// @param timestamp_us Conversion start time output buffer (can be NULL)
     /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if handle is NULL, otherwise see onewire_bus_reset and onewire_bus_write_bytes
-    esp_err_t trigger_temperature_conversion(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number)
+    esp_err_t trigger_temperature_conversion(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number,
+        int64_t* timestamp_us)
     {
-        ESP_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
 
-        ESP_RETURN_ON_ERROR(onewire_bus_reset(handle), TAG, "error while resetting bus"); // reset bus and check if the device is present
+        BusLock lock(handle);
+        DS18B20_RETURN_ON_ERROR(bus_reset(handle), TAG, "error while resetting bus"); // reset bus and check if the device is present
 
         uint8_t tx_buffer[10];
         uint8_t tx_buffer_size;
@@ -109,89 +734,396 @@ namespace ds18b20
             tx_buffer_size = 2;
         }
 
-        ESP_RETURN_ON_ERROR(onewire_bus_write_bytes(handle, tx_buffer, tx_buffer_size),
+        DS18B20_RETURN_ON_ERROR(bus_write_bytes(handle, tx_buffer, tx_buffer_size),
                             TAG, "error while triggering temperature convert");
+        if (timestamp_us) *timestamp_us = esp_timer_get_time(); // the conversion starts with the last command bit
+        count_transaction(handle, &stats_t::conversions);
 
         return ESP_OK;
     }
 
-    /// @brief Read DS18B20 temperature conversion result
+    esp_err_t trigger_conversion_with_pullup(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, bool* engaged)
+    {
+        *engaged = false;
+        BusLock lock(handle);
+        DS18B20_RETURN_ON_ERROR(select(handle, rom_number, DS18B20_CMD_CONVERT_TEMP, NULL, 0, engaged),
+                            TAG, "error while triggering temperature convert");
+        count_transaction(handle, &stats_t::conversions);
+
+        return ESP_OK;
+    }
+
+    /// @brief Poll read time slots until the device(s) release the bus, i.e. conversion is done
+    /// @param handle OneWire bus handle
+    /// @param timeout_us Maximum time to wait
+    /// @param poll_interval_ms Yield between polls (at least one tick)
+    /// @return ESP_OK if conversion is done, ESP_ERR_TIMEOUT if it's not done in time, otherwise see onewire_bus_read_bit
+    esp_err_t wait_conversion_done(onewire_bus_handle_t handle, uint32_t timeout_us, uint32_t poll_interval_ms)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+
+        BusLock lock(handle); // any transaction in between ends the status read slots
+        TickType_t poll_ticks = pdMS_TO_TICKS(poll_interval_ms);
+        if (poll_ticks == 0) poll_ticks = 1;
+        int64_t deadline = esp_timer_get_time() + timeout_us;
+        uint8_t done = 0;
+
+        while (true) {
+            DS18B20_RETURN_ON_ERROR(bus_read_bit(handle, &done), TAG, "error while polling conversion status");
+            if (done) break;
+            if (esp_timer_get_time() >= deadline) {
+                count_error(handle, ESP_ERR_TIMEOUT);
+                return ESP_ERR_TIMEOUT;
+            }
+            vTaskDelay(poll_ticks);
+        }
+
+        return ESP_OK;
+    }
+
+    /// @brief Read DS18B20 temperature conversion result in sensor units
     /// @param handle OneWire bus handle
     /// @param rom_number Device ROM ID (or NULL to SKIP ROM, suitable for single device bus)
-    /// @param temperature Temperature output buffer
+    /// @param temperature Temperature output buffer, 1/16 degrees C
     /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if handle or temperature output buffer is null,
     /// ESP_ERR_INVALID_CRC if CRC doesn't match, otherwise see onewire_bus_reset, onewire_bus_write_bytes, onewire_bus_read_bytes
-    esp_err_t get_temperature(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, float *temperature)
+    esp_err_t get_temperature_raw(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, int16_t *temperature)
     {
-        ESP_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
-        ESP_RETURN_ON_FALSE(temperature, ESP_ERR_INVALID_ARG, TAG, "invalid temperature pointer");
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+        DS18B20_RETURN_ON_FALSE(temperature, ESP_ERR_INVALID_ARG, TAG, "invalid temperature pointer");
+
+        scratchpad_t scratchpad;
+        DS18B20_RETURN_ON_ERROR(read_scratchpad(handle, rom_number, &scratchpad), TAG, "error while reading scratchpad");
+
+        *temperature = decode_raw(scratchpad, family_of(rom_number));
+
+        return ESP_OK;
+    }
+
+    /// @brief Read DS18B20 temperature registers only (and optionally configuration), skipping the rest of the scratchpad and CRC
+    /// @param handle OneWire bus handle
+    /// @param rom_number Device ROM ID (or NULL to SKIP ROM, suitable for single device bus)
+    /// @param length Number of scratchpad bytes to read
+    /// @param resolution Resolution used for masking when configuration register is not read
+    /// @param temperature Temperature output buffer, 1/16 degrees C
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if handle or temperature output buffer is null,
+    /// ESP_ERR_INVALID_CRC if CRC doesn't match (full read only), otherwise see onewire_bus_reset, onewire_bus_write_bytes, onewire_bus_read_bytes
+    esp_err_t get_temperature_raw_partial(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number,
+        read_length_t length, resolution_t resolution, int16_t *temperature)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+        DS18B20_RETURN_ON_FALSE(temperature, ESP_ERR_INVALID_ARG, TAG, "invalid temperature pointer");
+
+        scratchpad_t scratchpad;
+        scratchpad.configuration = resolution; // overwritten unless only temperature is read
+        DS18B20_RETURN_ON_ERROR(read_scratchpad(handle, rom_number, &scratchpad, length),
+                            TAG, "error while reading scratchpad");
 
-        ESP_RETURN_ON_ERROR(onewire_bus_reset(handle), TAG, "error while resetting bus"); // reset bus and check if the device is present
+        *temperature = decode_raw(scratchpad, family_of(rom_number), length);
+
+        return ESP_OK;
+    }
+
+    /// @brief Read DS18B20 whole scratchpad and classify the temperature as a conversion result or the power-on value
+    /// @param handle OneWire bus handle
+    /// @param rom_number Device ROM ID (or NULL to SKIP ROM, suitable for single device bus)
+    /// @param temperature Temperature output buffer, 1/16 degrees C
+    /// @param freshness Classification output buffer
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if handle or an output buffer is null,
+    /// ESP_ERR_INVALID_CRC if CRC doesn't match, otherwise see onewire_bus_reset, onewire_bus_write_bytes, onewire_bus_read_bytes
+    esp_err_t get_temperature_checked(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number,
+        int16_t *temperature, reading_class_t* freshness)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+        DS18B20_RETURN_ON_FALSE(temperature && freshness, ESP_ERR_INVALID_ARG, TAG, "invalid output pointer");
 
         scratchpad_t scratchpad;
+        DS18B20_RETURN_ON_ERROR(read_scratchpad(handle, rom_number, &scratchpad),
+                            TAG, "error while reading scratchpad");
+
+        *temperature = decode_raw(scratchpad, family_of(rom_number));
+        // a DS18S20 keeps COUNT REMAIN in byte 6, 0x0C at power-on too, a real 85.0 degrees C can't be told apart there
+        bool power_on = *temperature == DS18B20_POWER_ON_RAW && scratchpad._reserved2 == DS18B20_POWER_ON_RESERVED2;
+        *freshness = power_on ? READING_POWER_ON : READING_FRESH;
+
+        return ESP_OK;
+    }
+
+    /// @brief Read DS18B20 temperature conversion result in 0.01 degrees C, without floating point math
+    /// @param handle OneWire bus handle
+    /// @param rom_number Device ROM ID (or NULL to SKIP ROM, suitable for single device bus)
+    /// @param temperature Temperature output buffer, 0.01 degrees C
+    /// @return See get_temperature_raw
+    esp_err_t get_temperature_centi(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, int32_t *temperature)
+    {
+        DS18B20_RETURN_ON_FALSE(temperature, ESP_ERR_INVALID_ARG, TAG, "invalid temperature pointer");
+
+        int16_t raw;
+        esp_err_t err = get_temperature_raw(handle, rom_number, &raw); // logs errors itself
+        if (err == ESP_OK) *temperature = raw_to_centi(raw);
+
+        return err;
+    }
+
+    /// @brief Read DS18B20 temperature conversion result
+    /// @param handle OneWire bus handle
+    /// @param rom_number Device ROM ID (or NULL to SKIP ROM, suitable for single device bus)
+    /// @param temperature Temperature output buffer
+    /// @return See get_temperature_raw
+    esp_err_t get_temperature(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, float *temperature)
+    {
+        DS18B20_RETURN_ON_FALSE(temperature, ESP_ERR_INVALID_ARG, TAG, "invalid temperature pointer");
+
+        int16_t raw;
+        esp_err_t err = get_temperature_raw(handle, rom_number, &raw); // logs errors itself
+        if (err == ESP_OK) *temperature = raw / 16.0f;
 
+        return err;
+    }
+
+    /// @brief Read scratchpads of several devices in chunks, CRC is checked per chunk
+    /// @param handle OneWire bus handle
+    /// @param roms Device ROM IDs
+    /// @param n Number of devices
+    /// @param result Called for every device with its index, result, temperature (1/16 degrees C) and read time
+    /// @return ESP_OK if every device was read, otherwise the first per-device error
+    template <typename F>
+    static esp_err_t read_batch(onewire_bus_handle_t handle, const onewire_device_address_t* roms, size_t n, F result)
+    {
+        // command template, only the ROM bytes are patched per device
         uint8_t tx_buffer[10];
-        uint8_t tx_buffer_size;
+        tx_buffer[0] = ONEWIRE_CMD_MATCH_ROM;
+        tx_buffer[9] = DS18B20_CMD_READ_SCRATCHPAD;
 
-        if (rom_number) { // specify rom id
-            tx_buffer[0] = ONEWIRE_CMD_MATCH_ROM;
-            tx_buffer[9] = DS18B20_CMD_READ_SCRATCHPAD;
-            memcpy(&tx_buffer[1], rom_number, sizeof(onewire_device_address_t));
-            tx_buffer_size = 10;
-        } else {
-            tx_buffer[0] = ONEWIRE_CMD_SKIP_ROM;
-            tx_buffer[1] = DS18B20_CMD_READ_SCRATCHPAD;
-            tx_buffer_size = 2;
+        esp_err_t ret = ESP_OK;
+        scratchpad_t chunk[8];
+        esp_err_t chunk_status[8];
+        int64_t chunk_time[8];
+        bool crc_ok[8];
+        for (size_t base = 0; base < n; base += 8) {
+            size_t chunk_size = n - base < 8 ? n - base : 8;
+            for (size_t i = 0; i < chunk_size; i++) {
+                memcpy(&tx_buffer[1], &roms[base + i], sizeof(onewire_device_address_t));
+                chunk_status[i] = read_scratchpad(handle, tx_buffer, sizeof(tx_buffer), &chunk[i], READ_FULL, false);
+                chunk_time[i] = esp_timer_get_time();
+            }
+            crc8_check(reinterpret_cast<const uint8_t*>(chunk), sizeof(scratchpad_t), chunk_size, crc_ok);
+            for (size_t i = 0; i < chunk_size; i++) {
+                esp_err_t err = chunk_status[i];
+                if (err == ESP_OK && !crc_ok[i]) {
+                    err = ESP_ERR_INVALID_CRC;
+                    count_error(handle, err);
+                }
+                if (err != ESP_OK && ret == ESP_OK) ret = err;
+                result(base + i, err, err == ESP_OK ? decode_raw(chunk[i], get_family(roms[base + i])) : static_cast<int16_t>(0), chunk_time[i]);
+            }
         }
 
-        ESP_RETURN_ON_ERROR(onewire_bus_write_bytes(handle, tx_buffer, tx_buffer_size),
-                            TAG, "error while sending read scratchpad command");
-        ESP_RETURN_ON_ERROR(onewire_bus_read_bytes(handle, reinterpret_cast<uint8_t*>(&scratchpad), sizeof(scratchpad)),
-                            TAG, "error while reading scratchpad command");
+        return ret;
+    }
 
-        ESP_RETURN_ON_FALSE(onewire_crc8(0, reinterpret_cast<uint8_t*>(&scratchpad), 8) == scratchpad.crc_value, ESP_ERR_INVALID_CRC,
-                            TAG, "crc error");
+    /// @brief Read DS18B20 temperature conversion results of several devices
+    /// @param handle OneWire bus handle
+    /// @param roms Device ROM IDs
+    /// @param n Number of devices
+    /// @param temperatures Temperature output buffer, n entries
+    /// @param status Per-device result output buffer, n entries (can be NULL)
+    /// @return ESP_OK if every device was read, ESP_ERR_INVALID_ARG if any pointer is null,
+    /// otherwise the first per-device error (see get_temperature)
+    esp_err_t get_temperatures(onewire_bus_handle_t handle, const onewire_device_address_t* roms, size_t n,
+        float* temperatures, esp_err_t* status)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+        DS18B20_RETURN_ON_FALSE(roms && temperatures, ESP_ERR_INVALID_ARG, TAG, "invalid buffer pointer");
 
-        static const uint8_t lsb_mask[4] = { 0x07, 0x03, 0x01, 0x00 };
-        uint8_t lsb_masked = scratchpad.temp_lsb & (~lsb_mask[scratchpad.configuration >> 5]); // mask bits not used in low resolution
-        *temperature = ((static_cast<uint16_t>(scratchpad.temp_msb) << 8) | lsb_masked)  / 16.0f;
+        return read_batch(handle, roms, n, [&](size_t i, esp_err_t err, int16_t raw, int64_t) {
+            if (err == ESP_OK) temperatures[i] = raw / 16.0f;
+            if (status) status[i] = err;
+        });
+    }
+
+    /// @brief Read DS18B20 temperature conversion results of several devices as timestamped records
+    /// @param handle OneWire bus handle
+    /// @param roms Device ROM IDs
+    /// @param n Number of devices
+    /// @param convert_us Conversion time, copied to every record
+    /// @param sequence Conversion sequence number, copied to every record
+    /// @param records Output buffer, n entries
+    /// @return ESP_OK if every device was read, ESP_ERR_INVALID_ARG if any pointer is null,
+    /// otherwise the first per-device error (see get_temperature)
+    esp_err_t get_temperature_records(onewire_bus_handle_t handle, const onewire_device_address_t* roms, size_t n,
+        int64_t convert_us, uint32_t sequence, record_t* records)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+        DS18B20_RETURN_ON_FALSE(roms && records, ESP_ERR_INVALID_ARG, TAG, "invalid buffer pointer");
+
+        return read_batch(handle, roms, n, [&](size_t i, esp_err_t err, int16_t raw, int64_t read_us) {
+            records[i].convert_us = convert_us;
+            records[i].read_us = read_us;
+            records[i].sequence = sequence;
+            records[i].raw = raw;
+            records[i].status = err;
+        });
+    }
+
+    /// @brief Read DS18B20 configuration registers
+    /// @param handle OneWire bus handle
+    /// @param rom_number Device ROM ID (or NULL to SKIP ROM, suitable for single device bus)
+    /// @param config Configuration output buffer
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if handle or config output buffer is null,
+    /// ESP_ERR_INVALID_CRC if CRC doesn't match, otherwise see onewire_bus_reset, onewire_bus_write_bytes, onewire_bus_read_bytes
+    esp_err_t read_config(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, config_t* config)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+        DS18B20_RETURN_ON_FALSE(config, ESP_ERR_INVALID_ARG, TAG, "invalid config pointer");
+
+        scratchpad_t scratchpad;
+        DS18B20_RETURN_ON_ERROR(read_scratchpad(handle, rom_number, &scratchpad),
+                            TAG, "error while reading scratchpad");
+
+        config->th = static_cast<int8_t>(scratchpad.th_user1);
+        config->tl = static_cast<int8_t>(scratchpad.tl_user2);
+        // DS18S20 has no configuration register, its fixed conversion time is that of 12 bits
+        config->resolution = family_of(rom_number) == FAMILY_DS18S20 ? RESOLUTION_12B : static_cast<resolution_t>(scratchpad.configuration);
 
         return ESP_OK;
     }
 
-    /// @brief Set DS18B20 temperature conversion resolution
+    /// @brief Write DS18B20 configuration registers (TH, TL and resolution) to the scratchpad
     /// @param handle OneWire bus handle
     /// @param rom_number Device ROM ID (or NULL to broadcast)
-    /// @param resolution Resolution
-    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if handle is NULL, otherwise see onewire_bus_reset and onewire_bus_write_bytes
-    esp_err_t set_resolution(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, resolution_t resolution)
+    /// @param config Configuration
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if handle or config is NULL, otherwise see onewire_bus_reset and onewire_bus_write_bytes
+    esp_err_t set_config(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, const config_t* config)
     {
-        ESP_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+        DS18B20_RETURN_ON_FALSE(config, ESP_ERR_INVALID_ARG, TAG, "invalid config pointer");
 
-        ESP_RETURN_ON_ERROR(onewire_bus_reset(handle), TAG, "error while resetting bus"); // reset bus and check if the device is present
+        uint8_t data[3] = { static_cast<uint8_t>(config->th), static_cast<uint8_t>(config->tl), config->resolution };
+        uint8_t data_size = family_of(rom_number) == FAMILY_DS18S20 ? 2 : 3; // DS18S20 takes TH and TL only
 
-        uint8_t tx_buffer[10];
-        uint8_t tx_buffer_size;
+        BusLock lock(handle);
+        count_transaction(handle, &stats_t::scratchpad_writes);
+        DS18B20_RETURN_ON_ERROR(select(handle, rom_number, DS18B20_CMD_WRITE_SCRATCHPAD, data, data_size),
+                            TAG, "error while sending write scratchpad command");
 
-        if (rom_number) { // specify rom id
-            tx_buffer[0] = ONEWIRE_CMD_MATCH_ROM;
-            tx_buffer[9] = DS18B20_CMD_WRITE_SCRATCHPAD;
-            memcpy(&tx_buffer[1], rom_number, sizeof(onewire_device_address_t));
-            tx_buffer_size = 10;
+        return ESP_OK;
+    }
+
+    /// @brief Read DS18B20 power supply mode
+    /// @param handle OneWire bus handle
+    /// @param rom_number Device ROM ID (or NULL to ask all devices)
+    /// @param mode Power supply mode output buffer
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if handle or mode is NULL, otherwise see onewire_bus_reset, onewire_bus_write_bytes, onewire_bus_read_bit
+    esp_err_t read_power_supply(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, power_mode_t* mode)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+        DS18B20_RETURN_ON_FALSE(mode, ESP_ERR_INVALID_ARG, TAG, "invalid mode pointer");
+
+        BusLock lock(handle);
+        DS18B20_RETURN_ON_ERROR(select(handle, rom_number, DS18B20_CMD_READ_POWER_SUPPLY),
+                            TAG, "error while sending read power supply command");
+
+        uint8_t external = 0;
+        DS18B20_RETURN_ON_ERROR(bus_read_bit(handle, &external), TAG, "error while reading power supply");
+        *mode = external ? POWER_EXTERNAL : POWER_PARASITE; // parasite-powered devices pull the bus low
+
+        return ESP_OK;
+    }
+
+    /// @brief Write the same configuration to several devices, optionally copying it to EEPROM
+    /// @param handle OneWire bus handle
+    /// @param roms Device ROM IDs (or NULL to broadcast to all devices with a single write)
+    /// @param n Number of devices (ignored for broadcast)
+    /// @param config Configuration
+    /// @param persist Copy scratchpad to EEPROM
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if handle or config is NULL, otherwise the first per-device error
+    /// (see onewire_bus_reset and onewire_bus_write_bytes), the rest of the devices are still configured
+    esp_err_t configure(onewire_bus_handle_t handle, const onewire_device_address_t* roms, size_t n, const config_t* config, bool persist)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+        DS18B20_RETURN_ON_FALSE(config, ESP_ERR_INVALID_ARG, TAG, "invalid config pointer");
+
+        // command templates, only the ROM bytes are patched per device
+        uint8_t write_buffer[13];
+        uint8_t copy_buffer[10];
+        uint8_t rom_size;
+
+        if (roms) {
+            write_buffer[0] = ONEWIRE_CMD_MATCH_ROM;
+            rom_size = 1 + sizeof(onewire_device_address_t);
         } else {
-            tx_buffer[0] = ONEWIRE_CMD_SKIP_ROM;
-            tx_buffer[1] = DS18B20_CMD_WRITE_SCRATCHPAD;
-            tx_buffer_size = 2;
+            write_buffer[0] = ONEWIRE_CMD_SKIP_ROM;
+            rom_size = 1;
+            n = 1;
         }
+        copy_buffer[0] = write_buffer[0];
+        write_buffer[rom_size] = DS18B20_CMD_WRITE_SCRATCHPAD;
+        write_buffer[rom_size + 1] = static_cast<uint8_t>(config->th);
+        write_buffer[rom_size + 2] = static_cast<uint8_t>(config->tl);
+        write_buffer[rom_size + 3] = config->resolution;
+        copy_buffer[rom_size] = DS18B20_CMD_COPY_SCRATCHPAD;
 
-        ESP_RETURN_ON_ERROR(onewire_bus_write_bytes(handle, tx_buffer, tx_buffer_size),
-                            TAG, "error while sending read scratchpad command");
+        esp_err_t ret = ESP_OK;
+        for (size_t i = 0; i < n; i++) {
+            if (roms) {
+                memcpy(&write_buffer[1], &roms[i], sizeof(onewire_device_address_t));
+                memcpy(&copy_buffer[1], &roms[i], sizeof(onewire_device_address_t));
+            }
+            BusLock lock(handle); // one device at a time, including the EEPROM write the bus must stay idle for
+            uint8_t write_size = roms && get_family(roms[i]) == FAMILY_DS18S20 ? rom_size + 3 : rom_size + 4; // no configuration register
+            count_transaction(handle, &stats_t::scratchpad_writes);
+            esp_err_t err = bus_reset(handle);
+            if (err == ESP_OK) err = bus_write_bytes(handle, write_buffer, write_size);
+            if (err == ESP_OK && persist) {
+                count_transaction(handle, &stats_t::eeprom_copies);
+                err = bus_reset(handle);
+                // EEPROM write, the bus must stay idle, parasite-powered devices need the strong pull-up
+                bool pullup = false;
+                if (err == ESP_OK) err = write_with_pullup(handle, copy_buffer, rom_size + 1, &pullup);
+                if (err == ESP_OK) {
+                    vTaskDelay(pdMS_TO_TICKS(DS18B20_EEPROM_WRITE_TIME_MS) + 1);
+                    if (pullup) strong_pullup(handle, false);
+                }
+            }
+            if (err != ESP_OK && ret == ESP_OK) ret = err;
+        }
+        DS18B20_RETURN_ON_ERROR(ret, TAG, "error while configuring devices");
 
-        tx_buffer[0] = 0;
-        tx_buffer[1] = 0;
-        tx_buffer[2] = resolution;
-        ESP_RETURN_ON_ERROR(onewire_bus_write_bytes(handle, tx_buffer, 3),
-                            TAG, "error while sending write scratchpad command");
+        return ESP_OK;
+    }
+
+    /// @brief Set DS18B20 temperature conversion resolution
+    /// @param handle OneWire bus handle
+    /// @param rom_number Device ROM ID (or NULL to broadcast)
+    /// @param resolution Resolution
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if handle is NULL, otherwise see read_config and set_config
+    esp_err_t set_resolution(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, resolution_t resolution)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+
+        config_t config = { .th = 0, .tl = 0, .resolution = resolution };
+        if (rom_number) { // keep TH/TL, a broadcast can't read them back from several devices
+            DS18B20_RETURN_ON_ERROR(read_config(handle, rom_number, &config), TAG, "error while reading configuration");
+            config.resolution = resolution;
+        }
+
+        return set_config(handle, rom_number, &config);
+    }
+
+    /// @brief Search 1-Wire bus for devices with the alarm flag set
+    /// @param handle OneWire bus handle
+    /// @param rom_id_buffer Pointer to the buffer for writing ROM IDs
+    /// @param max_instances Maximum number devices to look for
+    /// @param found Number of alarmed devices found
+    /// @return ESP_OK if succeeded (including no alarmed devices), ESP_ERR_INVALID_ARG if any pointer is NULL, otherwise see search_next
+    esp_err_t alarm_search(onewire_bus_handle_t handle, onewire_device_address_t* rom_id_buffer, size_t max_instances, size_t* found)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+        DS18B20_RETURN_ON_FALSE(rom_id_buffer && found, ESP_ERR_INVALID_ARG, TAG, "invalid buffer pointer");
+
+        DS18B20_RETURN_ON_ERROR(search_all(handle, ONEWIRE_CMD_SEARCH_ALARM, rom_id_buffer, max_instances, found),
+                            TAG, "alarm search error");
 
         return ESP_OK;
     }
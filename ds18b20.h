@@ -26,6 +26,10 @@
 #include "onewire_bus.h"
 
 #include <inttypes.h>
+#include <stddef.h>
+
+#define DS18B20_POWER_ON_RAW 0x0550 /*!< temperature register after power-on, 85 degrees C */
+#define DS18B20_CALIBRATION_GAIN_ONE (1 << 14) /*!< calibration_t::gain of 1.0 */
 
 namespace ds18b20
 {
@@ -36,23 +40,362 @@ namespace ds18b20
         RESOLUTION_9B = 0x1F, /*!< 93.75ms convert time */
     } resolution_t;
 
+    typedef enum {
+        FAMILY_DS18S20 = 0x10, /*!< DS18S20 and DS1820: 9-bit register extended to 1/16 degrees C with COUNT REMAIN, fixed 750ms convert time, no configuration register */
+        FAMILY_DS1822 = 0x22, /*!< DS1822: DS18B20 scratchpad format */
+        FAMILY_DS18B20 = 0x28, /*!< DS18B20 and MAX31820 */
+    } family_t;
+
+    typedef enum {
+        READ_TEMPERATURE = 2, /*!< temperature registers only, no CRC, caller supplies resolution for masking */
+        READ_CONFIGURATION = 5, /*!< up to configuration register, no CRC */
+        READ_FULL = 9, /*!< whole scratchpad, CRC checked */
+    } read_length_t;
+
+    typedef struct {
+        int8_t th; /*!< high alarm threshold or user byte 1 */
+        int8_t tl; /*!< low alarm threshold or user byte 2 */
+        resolution_t resolution; /*!< conversion resolution */
+    } config_t;
+
+    typedef struct {
+        int16_t offset; /*!< added after the gain, 1/16 degrees C */
+        uint16_t gain; /*!< fixed point, DS18B20_CALIBRATION_GAIN_ONE is 1.0 */
+    } calibration_t;
+
+#define DS18B20_CALIBRATION_NONE() { \
+        .offset = 0, \
+        .gain = DS18B20_CALIBRATION_GAIN_ONE, \
+    }
+
+    typedef enum {
+        POWER_UNKNOWN = 0, /*!< power supply not detected yet */
+        POWER_EXTERNAL, /*!< VDD pin powered */
+        POWER_PARASITE, /*!< powered from the data line */
+    } power_mode_t;
+
+    typedef enum {
+        READING_FRESH = 0, /*!< result of a conversion */
+        READING_POWER_ON, /*!< 85 degrees C power-on value, the device was reset and hasn't converted since */
+        READING_STALE, /*!< no conversion was addressed to the device since its previous read, set by the poller */
+    } reading_class_t;
+
+    typedef struct {
+        int64_t convert_us; /*!< esp_timer time of the Convert T command, as passed to get_temperature_records() */
+        int64_t read_us; /*!< esp_timer time of the read completion */
+        uint32_t sequence; /*!< conversion sequence number, as passed to get_temperature_records() */
+        int16_t raw; /*!< temperature, 1/16 degrees C, valid only if status is ESP_OK */
+        esp_err_t status; /*!< result of the read, see get_temperature() */
+    } record_t;
+
+    typedef struct {
+        uint32_t count; /*!< number of calls */
+        uint64_t time_us; /*!< cumulative time spent in the driver, us */
+    } op_stats_t;
+
+    typedef struct {
+        uint32_t presence_errors; /*!< resets without a presence pulse (ESP_ERR_NOT_FOUND) */
+        uint32_t crc_errors; /*!< scratchpad and ROM CRC mismatches */
+        uint32_t timeouts; /*!< conversions not finished in time */
+        uint32_t bus_errors; /*!< other errors reported by the 1-wire driver */
+        // the fields below are updated only with CONFIG_DS18B20_BUS_STATS
+        op_stats_t reset; /*!< onewire_bus_reset() */
+        op_stats_t write_bytes; /*!< onewire_bus_write_bytes() */
+        op_stats_t read_bytes; /*!< onewire_bus_read_bytes() */
+        op_stats_t write_bit; /*!< onewire_bus_write_bit() */
+        op_stats_t read_bit; /*!< onewire_bus_read_bit(), includes conversion status polling */
+        uint32_t conversions; /*!< Convert T commands sent, broadcast or addressed */
+        uint32_t scratchpad_reads; /*!< Read Scratchpad transactions, full or partial */
+        uint32_t scratchpad_writes; /*!< Write Scratchpad transactions */
+        uint32_t eeprom_copies; /*!< Copy Scratchpad transactions */
+        uint32_t search_passes; /*!< ROM search passes, normal, alarm or verify */
+    } stats_t;
+
+    typedef struct {
+        uint8_t rom[8]; /*!< ROM found by the last pass, also the branch taken at every discrepancy */
+        uint8_t last_discrepancy; /*!< bit number of the last zero-taken discrepancy, 0 if none */
+        bool last_device; /*!< the last pass found the last device */
+        uint8_t command; /*!< search ROM command */
+    } search_context_t;
+
+    /**
+     * @brief Strong pull-up control callback, e.g. switching a MOSFET between the data line and VCC
+     *
+     * @param[in] handle 1-wire handle the request is for
+     * @param[in] enable Enable (true) or release (false) the strong pull-up
+     * @param[in] ctx User context from set_strong_pullup()
+     * @return ESP_OK if succeeded
+     */
+    typedef esp_err_t (*strong_pullup_t)(onewire_bus_handle_t handle, bool enable, void* ctx);
+
+    /**
+     * @brief Search triplet callback for bus masters that run the ROM search in hardware (e.g. DS2482 1-Wire Triplet):
+     * read a bit and its complement, then write the direction taken
+     *
+     * @param[in] handle 1-wire handle the request is for
+     * @param[in] direction Direction to take if both 0 and 1 are present
+     * @param[out] id_bit Bit read
+     * @param[out] cmp_id_bit Complement read
+     * @param[out] taken Direction written (the bit read if only one is present, don't care if none)
+     * @param[in] ctx User context from set_search_triplet()
+     * @return ESP_OK if succeeded
+     */
+    typedef esp_err_t (*search_triplet_t)(onewire_bus_handle_t handle, uint8_t direction, uint8_t* id_bit, uint8_t* cmp_id_bit,
+        uint8_t* taken, void* ctx);
+
+    /**
+     * @brief Dallas/Maxim CRC8 (as used by ROM numbers and scratchpads)
+     *
+     * Bitwise (onewire_crc8()), 16+16 byte nibble table or 256 byte table, see CONFIG_DS18B20_CRC8_IMPL.
+     *
+     * @param[in] data Data
+     * @param[in] len Data length
+     * @return CRC
+     */
+    uint8_t crc8(const uint8_t* data, size_t len);
+
+    /**
+     * @brief Check CRC of several equally sized blocks (e.g. scratchpads) that end with their CRC byte
+     *
+     * @param[in] blocks Blocks, back to back
+     * @param[in] block_size Block size including the CRC byte
+     * @param[in] count Number of blocks
+     * @param[out] valid Per-block result (count entries)
+     * @return Number of blocks with CRC mismatch
+     */
+    size_t crc8_check(const uint8_t* blocks, size_t block_size, size_t count, bool* valid);
+
+    /**
+     * @brief Get worst-case temperature conversion time for a given resolution
+     *
+     * @param[in] resolution resolution of DS18B20's temperature conversion
+     * @param[in] family Family code, the resolution is ignored for fixed resolution families
+     * @return Conversion time in microseconds (datasheet maximum)
+     */
+    uint32_t get_conversion_time_us(resolution_t resolution, uint8_t family = FAMILY_DS18B20);
+
+    /**
+     * @brief Get the family code of a ROM number
+     *
+     * @param[in] address ROM number
+     * @return Family code, see family_t
+     */
+    inline uint8_t get_family(onewire_device_address_t address) { return address & 0xFF; }
+
+    /**
+     * @brief Check whether the library can read a family, all of them convert on the same broadcast Convert T
+     *
+     * @param[in] family Family code
+     * @return True for the family_t families
+     */
+    bool is_supported_family(uint8_t family);
+
+    /**
+     * @brief Take a per-bus slot (see CONFIG_DS18B20_MAX_BUSES) for settings and statistics, before the bus is used.
+     * Slots are reference counted: Poller and DS2482 register their buses, and so do a registered strong pull-up,
+     * a search triplet and enable_bus_lock(). Errors and transactions are only counted on registered buses.
+     *
+     * @param[in] handle 1-wire handle
+     * @return
+     *         - ESP_OK                Registered, release with unregister_bus().
+     *         - ESP_ERR_INVALID_ARG   Invalid argument.
+     *         - ESP_ERR_NO_MEM        CONFIG_DS18B20_MAX_BUSES buses already have settings.
+     */
+    esp_err_t register_bus(onewire_bus_handle_t handle);
+
+    /**
+     * @brief Drop a reference taken with register_bus() or enable_bus_lock(), the last one frees the slot with its
+     * settings, statistics and lock. Call once the bus is no longer used, not concurrently with other use of the bus.
+     *
+     * @param[in] handle 1-wire handle
+     */
+    void unregister_bus(onewire_bus_handle_t handle);
+
+    /**
+     * @brief Register a strong pull-up for a bus with parasite-powered devices
+     *
+     * The library enables it right after Convert T and Copy Scratchpad commands and releases it once the
+     * operation is done. Without it, parasite-powered devices are converted in small groups instead of a broadcast.
+     * Bus masters that engage their pull-up after the next write (e.g. DS2482 SPU bit) are armed right before the command byte instead.
+     *
+     * @param[in] handle 1-wire handle
+     * @param[in] callback Strong pull-up control, NULL to unregister (and drop its reference to the bus slot)
+     * @param[in] ctx Passed to callback
+     * @param[in] arm_before_write Enable is requested before the command is written, the master engages the pull-up after the write itself
+     * @return
+     *         - ESP_OK                Registered.
+     *         - ESP_ERR_INVALID_ARG   Invalid argument.
+     *         - ESP_ERR_NO_MEM        CONFIG_DS18B20_MAX_BUSES buses already have settings.
+     */
+    esp_err_t set_strong_pullup(onewire_bus_handle_t handle, strong_pullup_t callback, void* ctx, bool arm_before_write = false);
+
+    /**
+     * @brief Register a hardware search triplet for a bus, ROM searches use it instead of three separate time slots
+     *
+     * @param[in] handle 1-wire handle
+     * @param[in] callback Search triplet, NULL to unregister (and drop its reference to the bus slot)
+     * @param[in] ctx Passed to callback
+     * @return
+     *         - ESP_OK                Registered.
+     *         - ESP_ERR_INVALID_ARG   Invalid argument.
+     *         - ESP_ERR_NO_MEM        CONFIG_DS18B20_MAX_BUSES buses already have settings.
+     */
+    esp_err_t set_search_triplet(onewire_bus_handle_t handle, search_triplet_t callback, void* ctx);
+
+    /**
+     * @brief Make transactions on a bus atomic, so several tasks can use it at once
+     *
+     * Every library transaction (reset, ROM command, function command and data) then holds a per-bus lock, and so
+     * do multi-step operations the bus must stay idle for (EEPROM copy, Convert T with strong pull-up, completion poll).
+     * The lock is a FreeRTOS mutex: waiting tasks take the bus in priority order and a low-priority holder inherits
+     * the priority of the waiter, so a control task preempts background search and configuration at the next transaction
+     * boundary instead of the end of the whole operation. Call before the bus is shared, from a single task.
+     * Every call also registers the bus (see register_bus()), the lock is deleted with the slot.
+     * Single is not locked.
+     *
+     * @param[in] handle 1-wire handle
+     * @return
+     *         - ESP_OK                Enabled (or already enabled), release with unregister_bus().
+     *         - ESP_ERR_INVALID_ARG   Invalid argument.
+     *         - ESP_ERR_NO_MEM        CONFIG_DS18B20_MAX_BUSES buses already have settings.
+     */
+    esp_err_t enable_bus_lock(onewire_bus_handle_t handle);
+
+    /**
+     * @brief Take the bus for a sequence of transactions that must not be interleaved with other tasks,
+     * e.g. trigger_temperature_conversion() and wait_conversion_done(). Library calls of the same task nest inside it.
+     *
+     * @param[in] handle 1-wire handle
+     * @param[in] timeout_ms Maximum time to wait, UINT32_MAX to wait forever
+     * @return
+     *         - ESP_OK                Taken, release with unlock_bus(). Also returned if the bus has no lock.
+     *         - ESP_ERR_INVALID_ARG   Invalid argument.
+     *         - ESP_ERR_TIMEOUT       The bus stayed busy.
+     */
+    esp_err_t lock_bus(onewire_bus_handle_t handle, uint32_t timeout_ms);
+
+    /**
+     * @brief Release the bus taken with lock_bus()
+     *
+     * @param[in] handle 1-wire handle
+     */
+    void unlock_bus(onewire_bus_handle_t handle);
+
+    /**
+     * @brief Get error counters of a bus
+     *
+     * Errors are counted where they originate, so nothing is counted twice as it propagates through the library.
+     * With CONFIG_DS18B20_BUS_STATS every bus primitive is also counted and timed, and so are the library's
+     * transactions, which is enough to work out how many devices a bus can sample at a given rate.
+     * Counting needs a per-bus slot, see register_bus().
+     *
+     * @param[in] handle 1-wire handle
+     * @param[out] stats Counters, all zero if nothing was counted or the bus is not registered
+     * @param[in] reset Clear counters after reading
+     * @return
+     *         - ESP_OK                Success.
+     *         - ESP_ERR_INVALID_ARG   Invalid argument.
+     */
+    esp_err_t get_stats(onewire_bus_handle_t handle, stats_t* stats, bool reset);
+
+    /**
+     * @brief Read power supply mode (Read Power Supply)
+     *
+     * @param[in] handle 1-wire handle with DS18B20 on
+     * @param[in] rom_number ROM number to specify which DS18B20 to ask, NULL to skip ROM (parasite if any device is parasite-powered)
+     * @param[out] mode power supply mode
+     * @return
+     *         - ESP_OK                Read power supply mode success.
+     *         - ESP_ERR_INVALID_ARG   Invalid argument.
+     *         - ESP_ERR_NOT_FOUND     There is no device present on 1-wire bus.
+     */
+    esp_err_t read_power_supply(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, power_mode_t* mode);
+
+    /**
+     * @brief Search 1-Wire bus for devices (legacy form, see the esp_err_t overload)
+     *
+     * @param[in] handle 1-wire handle
+     * @param[out] rom_id_buffer ROM numbers found
+     * @param[in] max_instances Size of rom_id_buffer
+     * @return Number of devices found, searching stops at the first error
+     */
     uint8_t search(onewire_bus_handle_t handle, onewire_device_address_t* rom_id_buffer, uint8_t max_instances);
 
+    /**
+     * @brief Search 1-Wire bus for devices, without heap allocation
+     *
+     * @param[in] handle 1-wire handle
+     * @param[out] rom_id_buffer ROM numbers found
+     * @param[in] max_instances Size of rom_id_buffer, use search_next() to walk a bus of unknown size
+     * @param[out] found Number of devices found
+     * @return
+     *         - ESP_OK                Search finished, including an empty bus, or rom_id_buffer is full.
+     *         - ESP_ERR_INVALID_ARG   Invalid argument.
+     *         - ESP_ERR_INVALID_CRC   Corrupt ROM received, found devices are still reported.
+     *         - Otherwise see search_next().
+     */
+    esp_err_t search(onewire_bus_handle_t handle, onewire_device_address_t* rom_id_buffer, size_t max_instances, size_t* found);
+
+    /**
+     * @brief Start a new resumable search (Maxim application note 187), the context is owned by the caller
+     *
+     * @param[out] context Search context
+     * @param[in] command ROM search command, ONEWIRE_CMD_SEARCH_NORMAL or ONEWIRE_CMD_SEARCH_ALARM
+     */
+    void search_begin(search_context_t* context, uint8_t command);
+
+    /**
+     * @brief Run one search pass, finds one device. Other bus transactions can run between passes.
+     *
+     * @param[in] handle 1-wire handle
+     * @param[inout] context Search context, resumes from the discrepancy left by the previous pass
+     * @param[out] address ROM number found
+     * @return
+     *         - ESP_OK                Device found, context->last_device is set if it's the last one.
+     *         - ESP_ERR_NOT_FOUND     No (more) devices, context is rewound to the beginning.
+     *         - ESP_ERR_INVALID_CRC   Corrupt ROM, context is rewound to the beginning.
+     *         - Otherwise see onewire_bus_reset(), onewire_bus_read_bit(), onewire_bus_write_bit().
+     */
+    esp_err_t search_next(onewire_bus_handle_t handle, search_context_t* context, onewire_device_address_t* address);
+
     /**
      * @brief Trigger temperature conversion of DS18B20
      *
      * @param[in] handle 1-wire handle with DS18B20 on
      * @param[in] rom_number ROM number to specify which DS18B20 to send command, NULL to skip ROM
+     * @param[out] timestamp_us esp_timer time the command was sent, i.e. the conversion started (can be NULL)
      * @return
      *         - ESP_OK                Trigger tempreture convertsion success.
      *         - ESP_ERR_INVALID_ARG   Invalid argument.
      *         - ESP_ERR_NOT_FOUND     There is no device present on 1-wire bus.
      */
-    esp_err_t trigger_temperature_conversion(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number);
+    esp_err_t trigger_temperature_conversion(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number,
+        int64_t* timestamp_us = NULL);
+
+    /**
+     * @brief Wait for temperature conversion to finish by polling read time slots
+     *
+     * Must be called right after trigger_temperature_conversion() without any other bus traffic in between,
+     * hold lock_bus() across both on a bus shared with enable_bus_lock().
+     * The device holds the bus low during read slots until the conversion is done, so with a broadcast
+     * conversion this returns when the slowest device is done. Not usable with parasite-powered devices.
+     *
+     * @param[in] handle 1-wire handle with DS18B20 on
+     * @param[in] timeout_us Give up after this time, normally get_conversion_time_us() plus some margin
+     * @param[in] poll_interval_ms Time to yield between polls, rounded up to at least one tick
+     * @return
+     *         - ESP_OK                Conversion finished.
+     *         - ESP_ERR_INVALID_ARG   Invalid argument.
+     *         - ESP_ERR_TIMEOUT       Conversion still in progress after timeout_us.
+     */
+    esp_err_t wait_conversion_done(onewire_bus_handle_t handle, uint32_t timeout_us, uint32_t poll_interval_ms);
 
     /**
      * @brief Get temperature from DS18B20
      *
+     * The scratchpad is decoded according to the family code of the ROM number (see family_t), so DS18S20,
+     * DS1822 and DS18B20 can share a bus. SKIP ROM assumes a DS18B20.
+     *
      * @param[in] handle 1-wire handle with DS18B20 on
      * @param[in] rom_number ROM number to specify which DS18B20 to read from, NULL to skip ROM
      * @param[out] temperature result from DS18B20
@@ -64,9 +407,181 @@ namespace ds18b20
      */
     esp_err_t get_temperature(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, float *temperature);
 
+    /**
+     * @brief Get temperature from DS18B20 in sensor units, without floating point math
+     *
+     * @param[in] handle 1-wire handle with DS18B20 on
+     * @param[in] rom_number ROM number to specify which DS18B20 to read from, NULL to skip ROM
+     * @param[out] temperature result from DS18B20, 1/16 degrees C, bits undefined in low resolution modes are cleared
+     * @return
+     *         - ESP_OK                Get tempreture from DS18B20 success.
+     *         - ESP_ERR_INVALID_ARG   Invalid argument.
+     *         - ESP_ERR_NOT_FOUND     There is no device present on 1-wire bus.
+     *         - ESP_ERR_INVALID_CRC   CRC check failed.
+     */
+    esp_err_t get_temperature_raw(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, int16_t *temperature);
+
+    /**
+     * @brief Get temperature from DS18B20 reading only the first bytes of the scratchpad
+     *
+     * The read is cut short (the reset of the next transaction terminates it), which saves most of the
+     * scratchpad bus time, but leaves the data without CRC protection unless READ_FULL is requested.
+     * A partial read of a DS18S20 has 0.5 degrees C resolution, COUNT REMAIN is only in the full scratchpad.
+     *
+     * @param[in] handle 1-wire handle with DS18B20 on
+     * @param[in] rom_number ROM number to specify which DS18B20 to read from, NULL to skip ROM
+     * @param[in] length Number of scratchpad bytes to read
+     * @param[in] resolution Known device resolution, used for masking if the configuration register is not read
+     * @param[out] temperature result from DS18B20, 1/16 degrees C
+     * @return See get_temperature_raw(), ESP_ERR_INVALID_CRC is only possible for READ_FULL
+     */
+    esp_err_t get_temperature_raw_partial(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number,
+        read_length_t length, resolution_t resolution, int16_t *temperature);
+
+    /**
+     * @brief Get temperature from DS18B20 and tell a conversion result from the power-on value
+     *
+     * A conversion that measures 85 degrees C leaves 0x10 in scratchpad byte 6, the power-on value is 0x0C,
+     * so the full read costs nothing extra.
+     *
+     * @param[in] handle 1-wire handle with DS18B20 on
+     * @param[in] rom_number ROM number to specify which DS18B20 to read from, NULL to skip ROM
+     * @param[out] temperature result from DS18B20, 1/16 degrees C
+     * @param[out] freshness READING_FRESH or READING_POWER_ON
+     * @return See get_temperature_raw()
+     */
+    esp_err_t get_temperature_checked(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number,
+        int16_t *temperature, reading_class_t* freshness);
+
+    /**
+     * @brief Get temperature from DS18B20 in 0.01 degrees C, without floating point math
+     *
+     * @param[in] handle 1-wire handle with DS18B20 on
+     * @param[in] rom_number ROM number to specify which DS18B20 to read from, NULL to skip ROM
+     * @param[out] temperature result from DS18B20, 0.01 degrees C
+     * @return See get_temperature_raw()
+     */
+    esp_err_t get_temperature_centi(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, int32_t *temperature);
+
+    /**
+     * @brief Convert sensor units (1/16 degrees C) to 0.01 degrees C, rounding half away from zero
+     *
+     * @param[in] raw Temperature, 1/16 degrees C
+     * @return Temperature, 0.01 degrees C
+     */
+    inline int32_t raw_to_centi(int16_t raw)
+    {
+        int32_t x = static_cast<int32_t>(raw) * 25; // 100 / 16 = 25 / 4
+        return (x + (x < 0 ? -2 : 2)) / 4;
+    }
+
+    /**
+     * @brief Correct a reading with per-sensor calibration, raw * gain + offset in integer math,
+     * the product rounded half away from zero and the result saturated to int16_t
+     *
+     * @param[in] raw Temperature, 1/16 degrees C
+     * @param[in] calibration Calibration
+     * @return Corrected temperature, 1/16 degrees C
+     */
+    inline int16_t calibrate(int16_t raw, const calibration_t& calibration)
+    {
+        int64_t x = static_cast<int64_t>(raw) * calibration.gain;
+        x = (x + (x < 0 ? -DS18B20_CALIBRATION_GAIN_ONE / 2 : DS18B20_CALIBRATION_GAIN_ONE / 2)) / DS18B20_CALIBRATION_GAIN_ONE;
+        x += calibration.offset;
+        return static_cast<int16_t>(x < INT16_MIN ? INT16_MIN : x > INT16_MAX ? INT16_MAX : x);
+    }
+
+    /**
+     * @brief Get temperatures from several DS18B20 on one bus
+     *
+     * Arguments are checked once and a single command template is reused for the whole batch.
+     * Errors of one device don't stop the batch and are not logged.
+     *
+     * @param[in] handle 1-wire handle with DS18B20 on
+     * @param[in] roms ROM numbers of devices to read from
+     * @param[in] n Number of devices
+     * @param[out] temperatures results from DS18B20 (n entries), entries of failed devices are left untouched
+     * @param[out] status per-device result (n entries), see get_temperature(), can be NULL
+     * @return
+     *         - ESP_OK                Every device was read successfully.
+     *         - ESP_ERR_INVALID_ARG   Invalid argument.
+     *         - Otherwise             First per-device error.
+     */
+    esp_err_t get_temperatures(onewire_bus_handle_t handle, const onewire_device_address_t* roms, size_t n,
+        float* temperatures, esp_err_t* status);
+
+    /**
+     * @brief Get temperatures from several DS18B20 on one bus as timestamped records
+     *
+     * Like get_temperatures(), every record also carries the time of its read and the conversion it belongs to,
+     * so that consumers can compute sample age and align samples of several buses.
+     *
+     * @param[in] handle 1-wire handle with DS18B20 on
+     * @param[in] roms ROM numbers of devices to read from
+     * @param[in] n Number of devices
+     * @param[in] convert_us Time of the conversion, see trigger_temperature_conversion()
+     * @param[in] sequence Conversion sequence number, copied to every record
+     * @param[out] records Results (n entries)
+     * @return See get_temperatures()
+     */
+    esp_err_t get_temperature_records(onewire_bus_handle_t handle, const onewire_device_address_t* roms, size_t n,
+        int64_t convert_us, uint32_t sequence, record_t* records);
+
+    /**
+     * @brief Read DS18B20's configuration (TH, TL and resolution) from the scratchpad
+     *
+     * A DS18S20 (see family_t) has no configuration register and reports RESOLUTION_12B.
+     *
+     * @param[in] handle 1-wire handle with DS18B20 on
+     * @param[in] rom_number ROM number to specify which DS18B20 to read from, NULL to skip ROM
+     * @param[out] config configuration of DS18B20
+     * @return
+     *         - ESP_OK                Read DS18B20 configuration success.
+     *         - ESP_ERR_INVALID_ARG   Invalid argument.
+     *         - ESP_ERR_NOT_FOUND     There is no device present on 1-wire bus.
+     *         - ESP_ERR_INVALID_CRC   CRC check failed.
+     */
+    esp_err_t read_config(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, config_t* config);
+
+    /**
+     * @brief Write DS18B20's configuration (TH, TL and resolution) to the scratchpad, EEPROM is not affected
+     *
+     * Only TH and TL are written to an addressed DS18S20. A broadcast writes all three bytes, DS18S20 ignore the last one.
+     *
+     * @param[in] handle 1-wire handle with DS18B20 on
+     * @param[in] rom_number ROM number to specify which DS18B20 to write to, NULL to skip ROM
+     * @param[in] config configuration of DS18B20
+     * @return
+     *         - ESP_OK                Set DS18B20 configuration success.
+     *         - ESP_ERR_INVALID_ARG   Invalid argument.
+     *         - ESP_ERR_NOT_FOUND     There is no device present on 1-wire bus.
+     */
+    esp_err_t set_config(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, const config_t* config);
+
+    /**
+     * @brief Write the same configuration to several DS18B20, optionally copying it to EEPROM so it survives power loss
+     *
+     * With roms == NULL a single SKIP ROM write configures every device on the bus.
+     * Otherwise one command template is reused and only the ROM bytes are patched per device.
+     *
+     * @param[in] handle 1-wire handle with DS18B20 on
+     * @param[in] roms ROM numbers of devices to configure, NULL to configure all devices at once
+     * @param[in] n Number of devices, ignored if roms is NULL
+     * @param[in] config configuration of DS18B20
+     * @param[in] persist Issue Copy Scratchpad and wait for the EEPROM write (10 ms per write)
+     * @return
+     *         - ESP_OK                Configuration of every device success.
+     *         - ESP_ERR_INVALID_ARG   Invalid argument.
+     *         - Otherwise             First per-device error, the rest of the devices are still configured.
+     */
+    esp_err_t configure(onewire_bus_handle_t handle, const onewire_device_address_t* roms, size_t n, const config_t* config, bool persist);
+
     /**
      * @brief Set DS18B20's temperation conversion resolution
      *
+     * When a ROM number is given, TH/TL are read back and preserved. A broadcast (NULL ROM) clears TH/TL,
+     * use set_config() to broadcast a complete configuration.
+     *
      * @param[in] handle 1-wire handle with DS18B20 on
      * @param[in] rom_number ROM number to specify which DS18B20 to read from, NULL to skip ROM
      * @param[in] resolution resolution of DS18B20's temperation conversion
@@ -74,6 +589,21 @@ namespace ds18b20
      *         - ESP_OK                Set DS18B20 resolution success.
      *         - ESP_ERR_INVALID_ARG   Invalid argument.
      *         - ESP_ERR_NOT_FOUND     There is no device present on 1-wire bus.
+     *         - ESP_ERR_INVALID_CRC   CRC check failed while reading current TH/TL.
      */
     esp_err_t set_resolution(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, resolution_t resolution);
+
+    /**
+     * @brief Find devices whose last conversion result is outside of their TH/TL window (Alarm Search)
+     *
+     * @param[in] handle 1-wire handle with DS18B20 on
+     * @param[out] rom_id_buffer ROM numbers of alarmed devices
+     * @param[in] max_instances Size of rom_id_buffer
+     * @param[out] found Number of alarmed devices found
+     * @return
+     *         - ESP_OK                Search finished, including the case of no alarmed devices.
+     *         - ESP_ERR_INVALID_ARG   Invalid argument.
+     *         - ESP_ERR_INVALID_CRC   Corrupt ROM received.
+     */
+    esp_err_t alarm_search(onewire_bus_handle_t handle, onewire_device_address_t* rom_id_buffer, size_t max_instances, size_t* found);
 }
\ No newline at end of file
@@ -0,0 +1,318 @@
+/**
+ * @file ds18b20_ds2482.cpp
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief 1-Wire bus backend for DS2482-100/-800 I2C bridges.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ds18b20_ds2482.h"
+#include "ds18b20_private.h"
+
+#include "esp_timer.h"
+
+#include <type_traits>
+
+#define DS2482_CMD_DEVICE_RESET 0xF0
+#define DS2482_CMD_SET_READ_POINTER 0xE1
+#define DS2482_CMD_WRITE_CONFIG 0xD2
+#define DS2482_CMD_CHANNEL_SELECT 0xC3
+#define DS2482_CMD_1WIRE_RESET 0xB4
+#define DS2482_CMD_1WIRE_SINGLE_BIT 0x87
+#define DS2482_CMD_1WIRE_WRITE_BYTE 0xA5
+#define DS2482_CMD_1WIRE_READ_BYTE 0x96
+#define DS2482_CMD_1WIRE_TRIPLET 0x78
+
+#define DS2482_REG_DATA 0xE1
+
+#define DS2482_STATUS_1WB 0x01 /*!< 1-wire busy */
+#define DS2482_STATUS_PPD 0x02 /*!< presence pulse detected */
+#define DS2482_STATUS_SD 0x04 /*!< short detected */
+#define DS2482_STATUS_RST 0x10 /*!< device reset */
+#define DS2482_STATUS_SBR 0x20 /*!< single bit result */
+#define DS2482_STATUS_TSB 0x40 /*!< triplet second bit */
+#define DS2482_STATUS_DIR 0x80 /*!< branch direction taken */
+
+#define DS2482_CONFIG_APU 0x01 /*!< active pull-up */
+#define DS2482_CONFIG_SPU 0x04 /*!< strong pull-up after the next write */
+
+namespace ds18b20
+{
+    static const char *TAG = "ds18b20_ds2482";
+
+    static_assert(std::is_standard_layout<DS2482Channel>::value, "handle is cast back to DS2482Channel");
+
+    // DS2482-800 channel select codes and the values the channel selection register reads back
+    static const uint8_t channel_codes[DS2482_MAX_CHANNELS] = { 0xF0, 0xE1, 0xD2, 0xC3, 0xB4, 0xA5, 0x96, 0x87 };
+    static const uint8_t channel_readback[DS2482_MAX_CHANNELS] = { 0xB8, 0xB1, 0xAA, 0xA3, 0x9C, 0x95, 0x8E, 0x87 };
+
+    DS2482::DS2482(i2c_master_dev_handle_t device, const ds2482_config_t& config)
+        : device(device), config(config), selected(-1), configuration(config.active_pullup ? DS2482_CONFIG_APU : 0), registered(0)
+    {
+        for (size_t i = 0; i < DS2482_MAX_CHANNELS; i++) {
+            onewire_bus_t& base = channels[i].base;
+            base.reset = DS2482Channel::reset;
+            base.write_bytes = DS2482Channel::write_bytes;
+            base.read_bytes = DS2482Channel::read_bytes;
+            base.write_bit = DS2482Channel::write_bit;
+            base.read_bit = DS2482Channel::read_bit;
+            base.del = DS2482Channel::del;
+            channels[i].chip = this;
+            channels[i].channel = i;
+        }
+        lock = xSemaphoreCreateRecursiveMutexStatic(&lock_buffer);
+    }
+
+    DS2482::~DS2482()
+    {
+        for (size_t i = 0; i < registered; i++) { // frees the bus slots, so bridges can be created again
+            set_search_triplet(channels[i].handle(), NULL, NULL);
+            set_strong_pullup(channels[i].handle(), NULL, NULL);
+            unregister_bus(channels[i].handle());
+        }
+        vSemaphoreDelete(lock);
+    }
+
+    esp_err_t DS2482::init()
+    {
+        DS18B20_RETURN_ON_FALSE(device && config.channels && config.channels <= DS2482_MAX_CHANNELS, ESP_ERR_INVALID_ARG,
+                            TAG, "invalid DS2482 arguments");
+
+        xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+        const uint8_t cmd = DS2482_CMD_DEVICE_RESET;
+        uint8_t status = 0;
+        esp_err_t err = transmit(&cmd, 1);
+        if (err == ESP_OK) err = wait_idle(&status);
+        if (err == ESP_OK && !(status & DS2482_STATUS_RST)) err = ESP_ERR_INVALID_RESPONSE;
+        if (err == ESP_OK) err = write_config(configuration);
+        selected = config.channels > 1 ? -1 : 0; // DS2482-800 selects channel 0 after reset, but don't rely on it
+        xSemaphoreGiveRecursive(lock);
+        DS18B20_RETURN_ON_ERROR(err, TAG, "DS2482 initialization failed");
+
+        for (; registered < config.channels; registered++) {
+            DS18B20_RETURN_ON_ERROR(register_bus(channels[registered].handle()), TAG, "error while registering channel");
+        }
+        for (size_t i = 0; i < config.channels; i++) {
+            DS18B20_RETURN_ON_ERROR(set_search_triplet(channels[i].handle(), DS2482Channel::triplet, this),
+                                TAG, "error while registering search triplet");
+            DS18B20_RETURN_ON_ERROR(set_strong_pullup(channels[i].handle(), DS2482Channel::strong_pullup, this, true),
+                                TAG, "error while registering strong pull-up");
+        }
+
+        return ESP_OK;
+    }
+
+    /// @brief Take the bridge and switch it to a channel
+    /// @param channel Channel number
+    /// @return ESP_OK if succeeded, the bridge is held until end(), ESP_ERR_INVALID_RESPONSE if the channel wasn't selected, otherwise I2C error
+    esp_err_t DS2482::begin(uint8_t channel)
+    {
+        xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+        if (selected == channel) return ESP_OK;
+
+        const uint8_t cmd[2] = { DS2482_CMD_CHANNEL_SELECT, channel_codes[channel] };
+        uint8_t readback = 0;
+        esp_err_t err = i2c_master_transmit_receive(device, cmd, sizeof(cmd), &readback, 1, config.i2c_timeout_ms);
+        if (err == ESP_OK && readback != channel_readback[channel]) err = ESP_ERR_INVALID_RESPONSE;
+        if (err != ESP_OK) {
+            selected = -1;
+            xSemaphoreGiveRecursive(lock);
+            return err;
+        }
+        selected = channel;
+
+        return ESP_OK;
+    }
+
+    /// @brief Release the bridge taken by begin()
+    void DS2482::end()
+    {
+        xSemaphoreGiveRecursive(lock);
+    }
+
+    esp_err_t DS2482::transmit(const uint8_t* data, size_t size)
+    {
+        return i2c_master_transmit(device, data, size, config.i2c_timeout_ms);
+    }
+
+    /// @brief Read the status register until the 1-wire operation of the bridge is finished.
+    /// Every 1-wire command leaves the read pointer at the status register.
+    /// @param status Status output buffer
+    /// @return ESP_OK if idle, ESP_ERR_TIMEOUT if still busy after busy_timeout_us, otherwise I2C error
+    esp_err_t DS2482::wait_idle(uint8_t* status)
+    {
+        int64_t deadline = esp_timer_get_time() + config.busy_timeout_us;
+        do {
+            esp_err_t err = i2c_master_receive(device, status, 1, config.i2c_timeout_ms);
+            if (err != ESP_OK) return err;
+            if (!(*status & DS2482_STATUS_1WB)) return ESP_OK;
+        } while (esp_timer_get_time() < deadline);
+
+        return ESP_ERR_TIMEOUT;
+    }
+
+    /// @brief Write the configuration register, the upper nibble has to be the complement of the lower one
+    /// @param value Configuration bits
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_RESPONSE if the register didn't take the value, otherwise I2C error
+    esp_err_t DS2482::write_config(uint8_t value)
+    {
+        const uint8_t cmd[2] = { DS2482_CMD_WRITE_CONFIG, static_cast<uint8_t>(value | ((~value & 0x0F) << 4)) };
+        uint8_t readback = 0;
+        esp_err_t err = i2c_master_transmit_receive(device, cmd, sizeof(cmd), &readback, 1, config.i2c_timeout_ms);
+        if (err != ESP_OK) return err;
+        return readback == value ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
+    }
+
+    esp_err_t DS2482Channel::reset(onewire_bus_t* bus)
+    {
+        DS2482Channel* ch = from(bus);
+        DS2482* chip = ch->chip;
+        esp_err_t err = chip->begin(ch->channel);
+        if (err != ESP_OK) return err;
+
+        const uint8_t cmd = DS2482_CMD_1WIRE_RESET;
+        uint8_t status = 0;
+        err = chip->transmit(&cmd, 1);
+        if (err == ESP_OK) err = chip->wait_idle(&status);
+        chip->end();
+        if (err != ESP_OK) return err;
+
+        if (status & DS2482_STATUS_SD) return ESP_FAIL; // shorted line
+        return (status & DS2482_STATUS_PPD) ? ESP_OK : ESP_ERR_NOT_FOUND;
+    }
+
+    esp_err_t DS2482Channel::write_bytes(onewire_bus_t* bus, const uint8_t* tx_data, uint8_t tx_data_size)
+    {
+        DS2482Channel* ch = from(bus);
+        DS2482* chip = ch->chip;
+        esp_err_t err = chip->begin(ch->channel);
+        if (err != ESP_OK) return err;
+
+        uint8_t status;
+        for (uint8_t i = 0; i < tx_data_size && err == ESP_OK; i++) {
+            const uint8_t cmd[2] = { DS2482_CMD_1WIRE_WRITE_BYTE, tx_data[i] };
+            err = chip->transmit(cmd, sizeof(cmd));
+            if (err == ESP_OK) err = chip->wait_idle(&status);
+        }
+        chip->end();
+
+        return err;
+    }
+
+    esp_err_t DS2482Channel::read_bytes(onewire_bus_t* bus, uint8_t* rx_buf, size_t rx_buf_size)
+    {
+        DS2482Channel* ch = from(bus);
+        DS2482* chip = ch->chip;
+        esp_err_t err = chip->begin(ch->channel);
+        if (err != ESP_OK) return err;
+
+        const uint8_t cmd = DS2482_CMD_1WIRE_READ_BYTE;
+        const uint8_t read_data[2] = { DS2482_CMD_SET_READ_POINTER, DS2482_REG_DATA };
+        uint8_t status;
+        for (size_t i = 0; i < rx_buf_size && err == ESP_OK; i++) {
+            err = chip->transmit(&cmd, 1);
+            if (err == ESP_OK) err = chip->wait_idle(&status);
+            if (err == ESP_OK) err = i2c_master_transmit_receive(chip->device, read_data, sizeof(read_data), &rx_buf[i], 1,
+                chip->config.i2c_timeout_ms);
+        }
+        chip->end();
+
+        return err;
+    }
+
+    esp_err_t DS2482Channel::write_bit(onewire_bus_t* bus, uint8_t tx_bit)
+    {
+        DS2482Channel* ch = from(bus);
+        DS2482* chip = ch->chip;
+        esp_err_t err = chip->begin(ch->channel);
+        if (err != ESP_OK) return err;
+
+        const uint8_t cmd[2] = { DS2482_CMD_1WIRE_SINGLE_BIT, static_cast<uint8_t>(tx_bit ? 0x80 : 0x00) };
+        uint8_t status;
+        err = chip->transmit(cmd, sizeof(cmd));
+        if (err == ESP_OK) err = chip->wait_idle(&status);
+        chip->end();
+
+        return err;
+    }
+
+    esp_err_t DS2482Channel::read_bit(onewire_bus_t* bus, uint8_t* rx_bit)
+    {
+        DS2482Channel* ch = from(bus);
+        DS2482* chip = ch->chip;
+        esp_err_t err = chip->begin(ch->channel);
+        if (err != ESP_OK) return err;
+
+        const uint8_t cmd[2] = { DS2482_CMD_1WIRE_SINGLE_BIT, 0x80 }; // a read slot is a written 1
+        uint8_t status = 0;
+        err = chip->transmit(cmd, sizeof(cmd));
+        if (err == ESP_OK) err = chip->wait_idle(&status);
+        chip->end();
+        if (err != ESP_OK) return err;
+
+        *rx_bit = (status & DS2482_STATUS_SBR) ? 1 : 0;
+        return ESP_OK;
+    }
+
+    esp_err_t DS2482Channel::del(onewire_bus_t* bus)
+    {
+        (void)bus; // channels belong to the DS2482 object
+        return ESP_OK;
+    }
+
+    /// @brief 1-Wire Triplet: the bridge reads both bits and writes the direction in one command
+    esp_err_t DS2482Channel::triplet(onewire_bus_handle_t handle, uint8_t direction, uint8_t* id_bit, uint8_t* cmp_id_bit,
+        uint8_t* taken, void* ctx)
+    {
+        DS2482Channel* ch = from(handle);
+        DS2482* chip = static_cast<DS2482*>(ctx);
+        esp_err_t err = chip->begin(ch->channel);
+        if (err != ESP_OK) return err;
+
+        const uint8_t cmd[2] = { DS2482_CMD_1WIRE_TRIPLET, static_cast<uint8_t>(direction ? 0x80 : 0x00) };
+        uint8_t status = 0;
+        err = chip->transmit(cmd, sizeof(cmd));
+        if (err == ESP_OK) err = chip->wait_idle(&status);
+        chip->end();
+        if (err != ESP_OK) return err;
+
+        *id_bit = (status & DS2482_STATUS_SBR) ? 1 : 0;
+        *cmp_id_bit = (status & DS2482_STATUS_TSB) ? 1 : 0;
+        *taken = (status & DS2482_STATUS_DIR) ? 1 : 0;
+        return ESP_OK;
+    }
+
+    /// @brief Arm the SPU bit, the bridge engages the strong pull-up after the next write, and keep the bridge on the
+    /// channel until the pull-up is released by clearing SPU
+    esp_err_t DS2482Channel::strong_pullup(onewire_bus_handle_t handle, bool enable, void* ctx)
+    {
+        DS2482Channel* ch = from(handle);
+        DS2482* chip = static_cast<DS2482*>(ctx);
+
+        if (enable) {
+            esp_err_t err = chip->begin(ch->channel);
+            if (err != ESP_OK) return err;
+            err = chip->write_config(chip->configuration | DS2482_CONFIG_SPU);
+            if (err != ESP_OK) chip->end();
+            return err; // the bridge stays taken while the pull-up is engaged
+        }
+
+        esp_err_t err = chip->write_config(chip->configuration);
+        chip->end(); // taken by enable
+        return err;
+    }
+} // namespace ds18b20
@@ -0,0 +1,152 @@
+/**
+ * @file ds18b20_ds2482.h
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief 1-Wire bus backend for DS2482-100/-800 I2C bridges.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "ds18b20.h"
+#include "onewire_bus_interface.h"
+
+#include "driver/i2c_master.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DS2482_MAX_CHANNELS 8 /*!< DS2482-800 */
+
+namespace ds18b20
+{
+    typedef struct {
+        uint8_t channels; /*!< 1 for DS2482-100, 8 for DS2482-800 */
+        bool active_pullup; /*!< APU: active pull-up at the end of every slot, for longer lines */
+        uint32_t i2c_timeout_ms; /*!< timeout of a single I2C transfer */
+        uint32_t busy_timeout_us; /*!< timeout of a single 1-wire operation of the bridge */
+    } ds2482_config_t;
+
+#define DS18B20_DS2482_DEFAULT_CONFIG() { \
+        .channels = 1, \
+        .active_pullup = true, \
+        .i2c_timeout_ms = 10, \
+        .busy_timeout_us = 5000, \
+    }
+
+    class DS2482;
+
+    /**
+     * @brief One 1-wire channel of a DS2482, usable with the library and the onewire_bus API.
+     * Search runs on the bridge's 1-Wire Triplet and the strong pull-up on its SPU bit, both are registered with
+     * the library by DS2482::init().
+     */
+    class DS2482Channel
+    {
+    public:
+        /**
+         * @brief Get the handle to use with the library and the onewire_bus API
+         *
+         * @return 1-wire handle
+         */
+        onewire_bus_handle_t handle() { return &base; }
+
+        DS2482Channel(const DS2482Channel&) = delete;
+        DS2482Channel& operator=(const DS2482Channel&) = delete;
+
+    private:
+        friend class DS2482;
+
+        DS2482Channel() = default; // channels exist only inside their DS2482
+
+        onewire_bus_t base; // must stay the first member, handles are cast back to DS2482Channel
+        DS2482* chip;
+        uint8_t channel;
+
+        static DS2482Channel* from(onewire_bus_t* bus) { return reinterpret_cast<DS2482Channel*>(bus); }
+        static esp_err_t reset(onewire_bus_t* bus);
+        static esp_err_t write_bytes(onewire_bus_t* bus, const uint8_t* tx_data, uint8_t tx_data_size);
+        static esp_err_t read_bytes(onewire_bus_t* bus, uint8_t* rx_buf, size_t rx_buf_size);
+        static esp_err_t write_bit(onewire_bus_t* bus, uint8_t tx_bit);
+        static esp_err_t read_bit(onewire_bus_t* bus, uint8_t* rx_bit);
+        static esp_err_t del(onewire_bus_t* bus);
+        static esp_err_t triplet(onewire_bus_handle_t handle, uint8_t direction, uint8_t* id_bit, uint8_t* cmp_id_bit,
+            uint8_t* taken, void* ctx);
+        static esp_err_t strong_pullup(onewire_bus_handle_t handle, bool enable, void* ctx);
+    };
+
+    /**
+     * @brief DS2482-100/-800 I2C to 1-Wire bridge. The bridge generates slot timing itself, so bus transactions
+     * cost I2C traffic instead of CPU time. Channels of a DS2482-800 share one 1-wire master: they can be used from
+     * different tasks (e.g. by MultiBus), every bridge command is serialized and the channel is switched as needed,
+     * which is safe between time slots. A strong pull-up keeps the bridge on its channel until released.
+     * Several bridges on different I2C addresses run fully in parallel.
+     */
+    class DS2482
+    {
+    public:
+        /**
+         * @brief Create a bridge, does not touch the I2C bus
+         *
+         * @param[in] device I2C device of the bridge, owned by the caller
+         * @param[in] config Bridge configuration
+         */
+        DS2482(i2c_master_dev_handle_t device, const ds2482_config_t& config);
+        ~DS2482();
+
+        /**
+         * @brief Reset and configure the bridge, register every channel, its search triplet and strong pull-up with the library.
+         * The destructor releases the bus slots (see ds18b20::register_bus()).
+         *
+         * @return
+         *         - ESP_OK                Bridge ready.
+         *         - ESP_ERR_INVALID_ARG   Invalid constructor arguments.
+         *         - ESP_ERR_INVALID_RESPONSE The device doesn't behave as a DS2482.
+         *         - ESP_ERR_NO_MEM        Failed to register channels, see CONFIG_DS18B20_MAX_BUSES.
+         *         - Otherwise             I2C error.
+         */
+        esp_err_t init();
+
+        /**
+         * @brief Get a channel
+         *
+         * @param[in] index Channel number, below ds2482_config_t::channels
+         * @return Channel or NULL if out of range
+         */
+        DS2482Channel* channel(size_t index) { return index < config.channels ? &channels[index] : NULL; }
+
+    private:
+        friend class DS2482Channel;
+
+        i2c_master_dev_handle_t device;
+        ds2482_config_t config;
+        DS2482Channel channels[DS2482_MAX_CHANNELS];
+        StaticSemaphore_t lock_buffer;
+        SemaphoreHandle_t lock;
+        int selected; /*!< channel the bridge is switched to, -1 if unknown */
+        uint8_t configuration; /*!< configuration register without SPU */
+        uint8_t registered; /*!< channels registered with the library, unregistered by the destructor */
+
+        esp_err_t begin(uint8_t channel);
+        void end();
+        esp_err_t transmit(const uint8_t* data, size_t size);
+        esp_err_t wait_idle(uint8_t* status);
+        esp_err_t write_config(uint8_t value);
+    };
+} // namespace ds18b20
@@ -0,0 +1,196 @@
+/**
+ * @file ds18b20_multibus.cpp
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Concurrent sampling of several 1-Wire buses with merged sample frames.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ds18b20_multibus.h"
+
+#include "esp_check.h"
+#include "esp_timer.h"
+
+#define START_BIT(i) (1u << (i))
+#define DONE_BIT(i) (1u << ((i) + DS18B20_MULTIBUS_MAX_BUSES))
+
+// Notification bits of the manager task: worker exits, start() and stop() requests
+#define EXIT_NOTIFY(i) (1u << (i))
+#define GO_NOTIFY (1u << DS18B20_MULTIBUS_MAX_BUSES)
+#define STOP_NOTIFY (1u << (DS18B20_MULTIBUS_MAX_BUSES + 1))
+
+namespace ds18b20
+{
+    static const char *TAG = "ds18b20_multibus";
+
+    static_assert(2 * DS18B20_MULTIBUS_MAX_BUSES <= 24, "event group has only 24 usable bits");
+
+    MultiBus::MultiBus(Poller* const* pollers, size_t count, const multibus_config_t& config)
+        : count(0), config(config), events(NULL), manager(NULL), stop_waiter(NULL), stop_requested(false)
+    {
+        if (pollers && count <= DS18B20_MULTIBUS_MAX_BUSES) {
+            for (size_t i = 0; i < count; i++) {
+                this->pollers[i] = pollers[i];
+                workers[i] = NULL;
+                worker_args[i].owner = this;
+                worker_args[i].index = i;
+            }
+            this->count = count;
+        }
+        frame.sequence = 0;
+        frame.bus_count = this->count;
+    }
+
+    MultiBus::~MultiBus()
+    {
+        if (is_running()) stop();
+    }
+
+    /// @brief Create the event group, then the manager task, then worker tasks pinned alternately to every core. The manager
+    /// owns the event group and the workers: it waits until they are all created and is the one to clean up if that fails.
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_STATE if already running, ESP_ERR_NO_MEM if resources couldn't be allocated
+    esp_err_t MultiBus::start()
+    {
+        DS18B20_RETURN_ON_FALSE(count && config.callback, ESP_ERR_INVALID_ARG, TAG, "invalid multi-bus arguments");
+        DS18B20_RETURN_ON_FALSE(!is_running(), ESP_ERR_INVALID_STATE, TAG, "multi-bus manager already running");
+
+        events = xEventGroupCreate();
+        DS18B20_RETURN_ON_FALSE(events, ESP_ERR_NO_MEM, TAG, "failed to create event group");
+
+        stop_requested = false;
+        for (size_t i = 0; i < count; i++) workers[i] = NULL;
+        if (xTaskCreate(manager_body, "ds18b20_mbus", config.manager_stack_size, this, config.manager_priority, &manager) != pdPASS) {
+            DS18B20_LOGE(TAG, "failed to create manager task");
+            manager = NULL;
+            vEventGroupDelete(events);
+            events = NULL;
+            return ESP_ERR_NO_MEM;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (xTaskCreatePinnedToCore(worker_body, "ds18b20_bus", config.worker_stack_size, &worker_args[i],
+                config.worker_priority, &workers[i], i % portNUM_PROCESSORS) != pdPASS) {
+                DS18B20_LOGE(TAG, "failed to create worker task");
+                workers[i] = NULL;
+                stop(); // the manager releases the workers created so far
+                return ESP_ERR_NO_MEM;
+            }
+        }
+        xTaskNotify(manager, GO_NOTIFY, eSetBits);
+
+        return ESP_OK;
+    }
+
+    /// @brief Stop manager and worker tasks, blocks until they exit
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_STATE if not running
+    esp_err_t MultiBus::stop()
+    {
+        DS18B20_RETURN_ON_FALSE(is_running(), ESP_ERR_INVALID_STATE, TAG, "multi-bus manager not running");
+
+        stop_waiter = xTaskGetCurrentTaskHandle();
+        stop_requested = true;
+        xTaskNotify(manager, STOP_NOTIFY, eSetBits); // interrupt the start or period wait
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        stop_waiter = NULL;
+
+        return ESP_OK;
+    }
+
+    /// @brief Release every worker, wait for all of them and publish the merged frame
+    void MultiBus::run_frame()
+    {
+        EventBits_t start_bits = 0, done_bits = 0;
+        for (size_t i = 0; i < count; i++) {
+            start_bits |= START_BIT(i);
+            done_bits |= DONE_BIT(i);
+        }
+
+        frame.start_us = esp_timer_get_time();
+        xEventGroupSetBits(events, start_bits);
+        xEventGroupWaitBits(events, done_bits, pdTRUE, pdTRUE, portMAX_DELAY);
+        frame.end_us = esp_timer_get_time();
+
+        if (!stop_requested) config.callback(&frame, config.callback_ctx);
+        frame.sequence++;
+    }
+
+    /// @brief Let workers exit, wait for their exit notifications and delete the event group, called from the manager task.
+    /// Workers signal their exit with a task notification and don't touch the event group or the object after it.
+    void MultiBus::stop_workers()
+    {
+        stop_requested = true;
+        uint32_t pending = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (!workers[i]) continue;
+            pending |= EXIT_NOTIFY(i);
+            xEventGroupSetBits(events, START_BIT(i));
+        }
+        while (pending) {
+            uint32_t notified = 0;
+            xTaskNotifyWait(0, pending, &notified, portMAX_DELAY);
+            pending &= ~notified;
+        }
+        for (size_t i = 0; i < count; i++) workers[i] = NULL;
+        vEventGroupDelete(events);
+        events = NULL;
+    }
+
+    void MultiBus::manager_body(void* arg)
+    {
+        MultiBus* self = static_cast<MultiBus*>(arg);
+        TickType_t period = pdMS_TO_TICKS(self->config.period_ms);
+
+        // start() is still creating the workers
+        uint32_t notified = 0;
+        while (!(notified & (GO_NOTIFY | STOP_NOTIFY))) xTaskNotifyWait(0, GO_NOTIFY, &notified, portMAX_DELAY);
+
+        while (!self->stop_requested) {
+            TickType_t frame_start = xTaskGetTickCount();
+            self->run_frame();
+            // wait for the rest of the period, stop() interrupts the wait
+            TickType_t elapsed = xTaskGetTickCount() - frame_start;
+            if (elapsed < period) xTaskNotifyWait(0, STOP_NOTIFY, NULL, period - elapsed);
+        }
+
+        self->stop_workers();
+        TaskHandle_t waiter = self->stop_waiter;
+        self->manager = NULL;
+        if (waiter) xTaskNotifyGive(waiter);
+        vTaskDelete(NULL);
+    }
+
+    void MultiBus::worker_body(void* arg)
+    {
+        worker_arg_t* w = static_cast<worker_arg_t*>(arg);
+        MultiBus* self = w->owner;
+        size_t i = w->index;
+        Poller* poller = self->pollers[i];
+
+        while (true) {
+            xEventGroupWaitBits(self->events, START_BIT(i), pdTRUE, pdTRUE, portMAX_DELAY);
+            if (self->stop_requested) break;
+            self->frame.status[i] = poller->run_cycle();
+            self->frame.readings[i] = poller->results();
+            self->frame.counts[i] = poller->result_count();
+            xEventGroupSetBits(self->events, DONE_BIT(i));
+        }
+
+        // the manager deletes the event group and stop() returns as soon as it is notified, self must not be touched after
+        TaskHandle_t manager = self->manager;
+        xTaskNotify(manager, EXIT_NOTIFY(i), eSetBits);
+        vTaskDelete(NULL);
+    }
+} // namespace ds18b20
@@ -0,0 +1,136 @@
+/**
+ * @file ds18b20_multibus.h
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Concurrent sampling of several 1-Wire buses with merged sample frames.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "ds18b20_poller.h"
+
+#include "freertos/event_groups.h"
+
+#define DS18B20_MULTIBUS_MAX_BUSES 12 /*!< start and done bits of every bus have to fit into one event group */
+
+namespace ds18b20
+{
+    typedef struct {
+        uint32_t sequence; /*!< frame number */
+        int64_t start_us; /*!< esp_timer time the cycle was started on all buses */
+        int64_t end_us; /*!< esp_timer time the last bus finished */
+        size_t bus_count; /*!< number of buses */
+        const reading_t* readings[DS18B20_MULTIBUS_MAX_BUSES]; /*!< readings of every bus, see Poller::results() */
+        size_t counts[DS18B20_MULTIBUS_MAX_BUSES]; /*!< number of readings of every bus */
+        esp_err_t status[DS18B20_MULTIBUS_MAX_BUSES]; /*!< cycle result of every bus, see Poller::run_cycle() */
+    } frame_t;
+
+    /**
+     * @brief Frame callback, called from the manager task when every bus has finished the cycle
+     *
+     * @param[in] frame Merged results, valid only during the call
+     * @param[in] ctx User context from multibus_config_t
+     */
+    typedef void (*frame_callback_t)(const frame_t* frame, void* ctx);
+
+    typedef struct {
+        uint32_t period_ms; /*!< frame period, 0 to start next frame right after the previous one */
+        frame_callback_t callback; /*!< called after every frame */
+        void* callback_ctx; /*!< passed to callback */
+        uint32_t worker_stack_size; /*!< per-bus worker task stack size, bytes */
+        UBaseType_t worker_priority; /*!< per-bus worker task priority */
+        uint32_t manager_stack_size; /*!< manager task stack size, bytes */
+        UBaseType_t manager_priority; /*!< manager task priority */
+    } multibus_config_t;
+
+#define DS18B20_MULTIBUS_DEFAULT_CONFIG() { \
+        .period_ms = 1000, \
+        .callback = NULL, \
+        .callback_ctx = NULL, \
+        .worker_stack_size = 3072, \
+        .worker_priority = 6, \
+        .manager_stack_size = 3072, \
+        .manager_priority = 5, \
+    }
+
+    /**
+     * @brief Runs conversion/read cycles of several buses at the same time, one worker task per bus,
+     * alternately pinned to the available cores, and merges their results into one frame.
+     * The pollers are driven through Poller::run_cycle(), their own tasks must not be started.
+     */
+    class MultiBus
+    {
+    public:
+        /**
+         * @brief Create a multi-bus manager, does not touch the buses
+         *
+         * @param[in] pollers One poller per bus, must outlive the manager
+         * @param[in] count Number of pollers, up to DS18B20_MULTIBUS_MAX_BUSES
+         * @param[in] config Manager configuration
+         */
+        MultiBus(Poller* const* pollers, size_t count, const multibus_config_t& config);
+        ~MultiBus();
+
+        MultiBus(const MultiBus&) = delete;
+        MultiBus& operator=(const MultiBus&) = delete;
+
+        /**
+         * @brief Start worker and manager tasks
+         *
+         * @return
+         *         - ESP_OK                Started.
+         *         - ESP_ERR_INVALID_ARG   Invalid constructor arguments.
+         *         - ESP_ERR_INVALID_STATE Already running.
+         *         - ESP_ERR_NO_MEM        Failed to create tasks or the event group.
+         */
+        esp_err_t start();
+
+        /**
+         * @brief Stop all tasks, blocks until the current frame is finished
+         *
+         * @return
+         *         - ESP_OK                Stopped.
+         *         - ESP_ERR_INVALID_STATE Not running.
+         */
+        esp_err_t stop();
+
+        bool is_running() const { return manager != NULL; }
+
+    private:
+        typedef struct {
+            MultiBus* owner;
+            size_t index;
+        } worker_arg_t;
+
+        Poller* pollers[DS18B20_MULTIBUS_MAX_BUSES];
+        worker_arg_t worker_args[DS18B20_MULTIBUS_MAX_BUSES];
+        size_t count;
+        multibus_config_t config;
+        EventGroupHandle_t events;
+        TaskHandle_t workers[DS18B20_MULTIBUS_MAX_BUSES];
+        TaskHandle_t manager;
+        TaskHandle_t stop_waiter;
+        volatile bool stop_requested;
+        frame_t frame;
+
+        void run_frame();
+        void stop_workers();
+        static void manager_body(void* arg);
+        static void worker_body(void* arg);
+    };
+} // namespace ds18b20
@@ -0,0 +1,72 @@
+/**
+ * @file ds18b20_nvs.cpp
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Device table snapshots in NVS for fast boot.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ds18b20_nvs.h"
+#include "ds18b20_private.h"
+
+namespace ds18b20
+{
+    static const char *TAG = "ds18b20_nvs";
+
+    /// @brief Serialize the table and store it as a blob
+    /// @param nvs NVS handle
+    /// @param key NVS key
+    /// @param table Device table
+    /// @param buffer Image scratch buffer
+    /// @param size Buffer size
+    /// @return ESP_OK if succeeded, otherwise see DeviceTable::save, nvs_set_blob and nvs_commit
+    esp_err_t save_table(nvs_handle_t nvs, const char* key, const DeviceTable& table, uint8_t* buffer, size_t size)
+    {
+        DS18B20_RETURN_ON_FALSE(key, ESP_ERR_INVALID_ARG, TAG, "invalid key");
+
+        size_t length;
+        DS18B20_RETURN_ON_ERROR(table.save(buffer, size, &length), TAG, "error while serializing device table");
+        DS18B20_RETURN_ON_ERROR(nvs_set_blob(nvs, key, buffer, length), TAG, "error while storing device table");
+        DS18B20_RETURN_ON_ERROR(nvs_commit(nvs), TAG, "error while committing device table");
+
+        return ESP_OK;
+    }
+
+    /// @brief Load a blob and restore the table from it
+    /// @param nvs NVS handle
+    /// @param key NVS key
+    /// @param table Empty device table
+    /// @param buffer Image scratch buffer
+    /// @param size Buffer size
+    /// @param verify Check presence of the devices
+    /// @param callback Delta callback (can be NULL)
+    /// @param ctx Callback context
+    /// @return ESP_OK if succeeded, ESP_ERR_NVS_NOT_FOUND if nothing is stored, otherwise see nvs_get_blob and DeviceTable::restore
+    esp_err_t load_table(nvs_handle_t nvs, const char* key, DeviceTable& table, uint8_t* buffer, size_t size, bool verify,
+        table_delta_callback_t callback, void* ctx)
+    {
+        DS18B20_RETURN_ON_FALSE(key && buffer, ESP_ERR_INVALID_ARG, TAG, "invalid load_table arguments");
+
+        size_t length = size;
+        esp_err_t err = nvs_get_blob(nvs, key, buffer, &length);
+        if (err == ESP_ERR_NVS_NOT_FOUND) return err; // first boot, not an error
+        if (err == ESP_ERR_NVS_INVALID_LENGTH) err = ESP_ERR_INVALID_SIZE;
+        DS18B20_RETURN_ON_ERROR(err, TAG, "error while loading device table");
+
+        return table.restore(buffer, length, verify, callback, ctx);
+    }
+} // namespace ds18b20
@@ -0,0 +1,70 @@
+/**
+ * @file ds18b20_nvs.h
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Device table snapshots in NVS for fast boot.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "ds18b20_registry.h"
+
+#include "nvs.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ds18b20
+{
+    /**
+     * @brief Store an image of a device table (see DeviceTable::save()) as an NVS blob and commit it.
+     * Call after the table has been configured and whenever it changes, e.g. from the delta callback of a task
+     * that owns the NVS handle, not on every cycle: every save is a flash write.
+     *
+     * @param[in] nvs NVS handle opened for writing
+     * @param[in] key NVS key, e.g. one per bus
+     * @param[in] table Device table
+     * @param[in] buffer Scratch buffer for the image, owned by the caller
+     * @param[in] size Buffer size, at least DS18B20_TABLE_IMAGE_SIZE(table.size())
+     * @return
+     *         - ESP_OK                Stored.
+     *         - Otherwise see DeviceTable::save(), nvs_set_blob() and nvs_commit().
+     */
+    esp_err_t save_table(nvs_handle_t nvs, const char* key, const DeviceTable& table, uint8_t* buffer, size_t size);
+
+    /**
+     * @brief Restore an empty device table from an NVS blob stored by save_table(), see DeviceTable::restore().
+     * If there is no usable image, nothing is restored and the table has to be filled with DeviceTable::scan().
+     *
+     * @param[in] nvs NVS handle
+     * @param[in] key NVS key
+     * @param[in] table Empty device table
+     * @param[in] buffer Scratch buffer for the image, owned by the caller
+     * @param[in] size Buffer size, at least DS18B20_TABLE_IMAGE_SIZE(table.capacity())
+     * @param[in] verify Check presence of the devices, see DeviceTable::restore()
+     * @param[in] callback Delta callback, can be NULL
+     * @param[in] ctx Passed to callback
+     * @return
+     *         - ESP_OK                Table restored.
+     *         - ESP_ERR_NVS_NOT_FOUND No image stored under key.
+     *         - ESP_ERR_INVALID_SIZE  Image doesn't fit the buffer or the table.
+     *         - Otherwise see nvs_get_blob() and DeviceTable::restore().
+     */
+    esp_err_t load_table(nvs_handle_t nvs, const char* key, DeviceTable& table, uint8_t* buffer, size_t size, bool verify = true,
+        table_delta_callback_t callback = NULL, void* ctx = NULL);
+} // namespace ds18b20
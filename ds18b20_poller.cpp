@@ -0,0 +1,624 @@
+/**
+ * @file ds18b20_poller.cpp
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Non-blocking whole-bus conversion scheduler for DS18B20.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ds18b20_poller.h"
+
+#include "esp_check.h"
+#include "esp_timer.h"
+#include "ds18b20_private.h"
+#include "onewire_cmd.h"
+
+#if CONFIG_DS18B20_LIGHT_SLEEP
+#include "driver/gpio.h"
+#include "esp_sleep.h"
+#define DS18B20_LIGHT_SLEEP_SUPPORTED true
+#else
+#define DS18B20_LIGHT_SLEEP_SUPPORTED false
+#endif
+
+namespace ds18b20
+{
+    static const char *TAG = "ds18b20_poller";
+
+    /// @brief Convert microseconds to ticks, rounding up and adding one tick to cover the partial tick vTaskDelay() starts in
+    /// @param us Microseconds
+    /// @return Ticks
+    static TickType_t us_to_ticks_ceil(uint32_t us)
+    {
+        return static_cast<TickType_t>((static_cast<uint64_t>(us) * configTICK_RATE_HZ + 999999) / 1000000) + 1;
+    }
+
+    Poller::Poller(DeviceTable& table, reading_t* readings, const poller_config_t& config)
+        : table(table), readings(readings), config(config), cycle(0), last_count(0), task(NULL), stop_waiter(NULL), stop_requested(false)
+    {
+        // take the bus slot up front, so statistics aren't claimed lazily from the poller task; without a free slot nothing is counted
+        registered = table.bus() && register_bus(table.bus()) == ESP_OK;
+    }
+
+    Poller::~Poller()
+    {
+        if (is_running()) stop();
+        if (registered) unregister_bus(table.bus());
+    }
+
+    /// @brief Start poller task
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_STATE if already running, ESP_ERR_NO_MEM if task creation failed
+    esp_err_t Poller::start()
+    {
+        DS18B20_RETURN_ON_FALSE(table.bus() && readings, ESP_ERR_INVALID_ARG, TAG, "invalid poller arguments");
+        DS18B20_RETURN_ON_FALSE(!is_running(), ESP_ERR_INVALID_STATE, TAG, "poller already running");
+        DS18B20_RETURN_ON_FALSE(DS18B20_LIGHT_SLEEP_SUPPORTED || !config.sleep.light_sleep, ESP_ERR_NOT_SUPPORTED,
+                            TAG, "light sleep requires CONFIG_DS18B20_LIGHT_SLEEP");
+
+        stop_requested = false;
+        DS18B20_RETURN_ON_FALSE(xTaskCreatePinnedToCore(task_body, "ds18b20", config.task_stack_size, this,
+                            config.task_priority, &task, config.task_core) == pdPASS, ESP_ERR_NO_MEM,
+                            TAG, "failed to create poller task");
+
+        return ESP_OK;
+    }
+
+    /// @brief Stop poller task, blocks until the task exits
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_STATE if not running
+    esp_err_t Poller::stop()
+    {
+        DS18B20_RETURN_ON_FALSE(is_running(), ESP_ERR_INVALID_STATE, TAG, "poller not running");
+
+        stop_waiter = xTaskGetCurrentTaskHandle();
+        stop_requested = true;
+        xTaskNotifyGive(task); // interrupt period wait
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        stop_waiter = NULL;
+
+        return ESP_OK;
+    }
+
+    /// @brief Run a cycle, failed reads are retried until the cycle budget from now is spent
+    /// @return See run_cycle_until
+    esp_err_t Poller::run_cycle()
+    {
+        return run_cycle_until(cycle_deadline_us(esp_timer_get_time()));
+    }
+
+    /// @brief Get the time after which a cycle started at start_us doesn't retry failed reads
+    /// @param start_us esp_timer time the cycle started
+    /// @return Deadline, esp_timer time
+    int64_t Poller::cycle_deadline_us(int64_t start_us) const
+    {
+        uint32_t budget_us = config.retry.cycle_budget_us;
+        return start_us + (budget_us ? static_cast<int64_t>(budget_us) : static_cast<int64_t>(config.period_ms) * 1000);
+    }
+
+    /// @brief Broadcast conversion, wait for the slowest device, read every scratchpad and publish results
+    /// @param deadline_us esp_timer time after which failed reads are not retried
+    /// @return ESP_OK if conversion was triggered (per-device status is in the readings), otherwise see trigger_temperature_conversion
+    esp_err_t Poller::run_cycle_until(int64_t deadline_us)
+    {
+        DS18B20_RETURN_ON_FALSE(table.bus() && readings, ESP_ERR_INVALID_ARG, TAG, "invalid poller arguments");
+        DS18B20_RETURN_ON_FALSE(DS18B20_LIGHT_SLEEP_SUPPORTED || !config.sleep.light_sleep, ESP_ERR_NOT_SUPPORTED,
+                            TAG, "light sleep requires CONFIG_DS18B20_LIGHT_SLEEP");
+
+        size_t count = table.size();
+        bool pipelined = config.pipeline_group_size && !config.alarm_only && !table.any_parasite();
+        esp_err_t err = pipelined ? ESP_OK : convert(); // a pipelined cycle converts while it reads
+        if (err == ESP_OK) {
+            const read_policy_t& policy = config.read_policy;
+            bool force_full = policy.crc_every && (cycle % policy.crc_every == 0);
+            if (config.alarm_only) {
+                count = read_alarmed(force_full, deadline_us);
+            } else if (pipelined) {
+                count = read_pipelined(force_full, deadline_us);
+            } else {
+                size_t n = 0;
+                for (size_t i = 0; i < count; i++) {
+                    if (!is_due(i)) continue;
+                    readings[n].index = i;
+                    readings[n].status = read_device(i, force_full, readings[n], config.reconvert, deadline_us);
+                    n++;
+                }
+                count = n;
+            }
+            if (config.reconvert) reconvert(count, force_full, deadline_us);
+        } else {
+            int64_t now = esp_timer_get_time();
+            for (size_t i = 0; i < count; i++) {
+                readings[i].index = i;
+                readings[i].status = err;
+                readings[i].sequence = cycle;
+                readings[i].convert_us = 0;
+                readings[i].read_us = now;
+            }
+        }
+        last_count = count;
+        publish(count);
+        if (config.search_every && (cycle % config.search_every == 0)) {
+            esp_err_t search_err = table.search_step(config.delta_callback, config.callback_ctx, NULL);
+            if (search_err != ESP_OK) DS18B20_LOGD(TAG, "hot-plug search step failed: %s", esp_err_to_name(search_err));
+        }
+        cycle++;
+
+        return err;
+    }
+
+    /// @brief Run the conversion with the fastest strategy that is safe for the power modes on the bus:
+    /// a broadcast if all devices are externally powered or a strong pull-up is available, otherwise
+    /// externally powered devices are converted together and parasite-powered ones in small groups
+    /// @return ESP_OK if conversion is done, otherwise see trigger_temperature_conversion
+    esp_err_t Poller::convert()
+    {
+        onewire_bus_handle_t bus = table.bus();
+
+        if (!table.any_parasite()) {
+            uint32_t wait_us = table.max_conversion_time_us(); // a broadcast conversion has to wait for the slowest device
+            int64_t convert_us;
+            if (config.poll_completion) {
+                // the status read slots have to follow the command, other tasks get the bus once conversion is done
+                lock_bus(bus, UINT32_MAX);
+                esp_err_t err = trigger_temperature_conversion(bus, NULL, &convert_us);
+                if (err == ESP_OK) {
+                    mark_converted(convert_us);
+                    // allow 10% margin over the datasheet maximum, the next read reports any late device anyway
+                    esp_err_t poll_err = wait_conversion_done(bus, wait_us + wait_us / 10, config.poll_interval_ms);
+                    if (poll_err != ESP_OK) DS18B20_LOGW(TAG, "conversion completion poll failed: %s", esp_err_to_name(poll_err));
+                }
+                unlock_bus(bus);
+                DS18B20_RETURN_ON_ERROR(err, TAG, "error while triggering conversion");
+            } else {
+                DS18B20_RETURN_ON_ERROR(trigger_temperature_conversion(bus, NULL, &convert_us), TAG, "error while triggering conversion");
+                mark_converted(convert_us);
+                wait_conversion(wait_us);
+            }
+            return ESP_OK;
+        }
+
+        if (has_strong_pullup(bus)) { // read slots can't be polled while the strong pull-up holds the line
+            uint32_t wait_us = table.max_conversion_time_us();
+            bool engaged;
+            lock_bus(bus, UINT32_MAX); // no traffic while the pull-up holds the line
+            esp_err_t err = trigger_conversion_with_pullup(bus, NULL, &engaged);
+            if (err == ESP_OK && engaged) {
+                mark_converted(esp_timer_get_time());
+                wait_conversion(wait_us);
+                err = strong_pullup(bus, false);
+            }
+            unlock_bus(bus);
+            DS18B20_RETURN_ON_ERROR(err, TAG, "error while triggering conversion");
+            DS18B20_RETURN_ON_FALSE(engaged, ESP_FAIL, TAG, "error while enabling strong pull-up");
+            return ESP_OK;
+        }
+
+        // externally powered devices don't load the bus, start them all first, they convert while parasitic groups are served
+        uint32_t external_wait_us = 0;
+        int64_t external_start = esp_timer_get_time();
+        for (size_t i = 0; i < table.size(); i++) {
+            if (table[i].power_mode != POWER_EXTERNAL) continue;
+            if (convert_device(i) == ESP_OK) {
+                uint32_t t = table.conversion_time_us(i);
+                if (t > external_wait_us) external_wait_us = t;
+            }
+        }
+        size_t group_size = config.parasite_group_size ? config.parasite_group_size : 1;
+        size_t in_group = 0;
+        uint32_t group_wait_us = 0;
+        for (size_t i = 0; i < table.size(); i++) {
+            if (table[i].power_mode == POWER_EXTERNAL) continue;
+            if (in_group == 0) lock_bus(bus, UINT32_MAX); // a group is powered by the idle line, other tasks wait for it
+            if (convert_device(i) == ESP_OK) {
+                uint32_t t = table.conversion_time_us(i);
+                if (t > group_wait_us) group_wait_us = t;
+            }
+            if (++in_group == group_size) {
+                wait_conversion(group_wait_us);
+                unlock_bus(bus);
+                in_group = 0;
+                group_wait_us = 0;
+            }
+        }
+        if (in_group) {
+            wait_conversion(group_wait_us);
+            unlock_bus(bus);
+        }
+        int64_t external_left = external_start + external_wait_us - esp_timer_get_time();
+        if (external_left > 0) wait_conversion(external_left);
+
+        return ESP_OK;
+    }
+
+    /// @brief Check whether an error is worth an immediate re-read: the line glitched, the scratchpad is still valid
+    /// @param err Read result
+    /// @return True if retryable
+    static bool is_retryable(esp_err_t err)
+    {
+        return err == ESP_ERR_INVALID_CRC || err == ESP_ERR_NOT_FOUND;
+    }
+
+    /// @brief Record that a broadcast conversion reached every device
+    /// @param convert_us esp_timer time of the Convert T command
+    void Poller::mark_converted(int64_t convert_us)
+    {
+        for (size_t i = 0; i < table.size(); i++) {
+            table[i].convert_cycle = cycle;
+            table[i].convert_us = convert_us;
+        }
+    }
+
+    /// @brief Address Convert T to one device and record it
+    /// @param i Device index
+    /// @return See trigger_temperature_conversion
+    esp_err_t Poller::convert_device(size_t i)
+    {
+        device_t& d = table[i];
+        esp_err_t err = trigger_temperature_conversion(table.bus(), &d.address, &d.convert_us);
+        if (err == ESP_OK) d.convert_cycle = cycle;
+        return err;
+    }
+
+    /// @brief Wait for a conversion, in light sleep with a timer wakeup if enabled and the wait is long enough
+    /// @param us Wait time, us
+    void Poller::wait_conversion(uint32_t us)
+    {
+#if CONFIG_DS18B20_LIGHT_SLEEP
+        const sleep_policy_t& policy = config.sleep;
+        if (policy.light_sleep && us >= policy.min_sleep_us) {
+            int64_t end = esp_timer_get_time() + us;
+            // keep the line and the strong pull-up driven as they are, a low pulse while asleep would reset the devices
+            if (policy.bus_gpio >= 0) gpio_hold_en(static_cast<gpio_num_t>(policy.bus_gpio));
+            if (policy.pullup_gpio >= 0) gpio_hold_en(static_cast<gpio_num_t>(policy.pullup_gpio));
+            esp_err_t err = esp_sleep_enable_timer_wakeup(us);
+            if (err == ESP_OK) err = esp_light_sleep_start();
+            esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER); // don't leave a stale duration to the next sleep
+            if (policy.pullup_gpio >= 0) gpio_hold_dis(static_cast<gpio_num_t>(policy.pullup_gpio));
+            if (policy.bus_gpio >= 0) gpio_hold_dis(static_cast<gpio_num_t>(policy.bus_gpio));
+            if (err != ESP_OK) DS18B20_LOGD(TAG, "light sleep failed: %s", esp_err_to_name(err));
+
+            // sleep was rejected or another wakeup source fired first
+            int64_t left = end - esp_timer_get_time();
+            if (left > 0) vTaskDelay(us_to_ticks_ceil(left));
+            return;
+        }
+#endif
+        vTaskDelay(us_to_ticks_ceil(us));
+    }
+
+    /// @brief Read one device according to the read and retry policies, partial readings that look wrong are re-read in full,
+    /// failed reads are repeated while the cycle's retry budget lasts. A power-on value or a device that missed the
+    /// conversion is reported as ESP_ERR_INVALID_STATE.
+    /// @param i Device index
+    /// @param force_full Skip partial read
+    /// @param r Reading to update
+    /// @param defer_invalid Don't record an invalid reading in the table, it will be re-converted and read again
+    /// @param deadline_us esp_timer time of the cycle after which failed reads are not retried
+    /// @return See get_temperature_raw_partial
+    esp_err_t Poller::read_device(size_t i, bool force_full, reading_t& r, bool defer_invalid, int64_t deadline_us)
+    {
+        const read_policy_t& policy = config.read_policy;
+        const device_t& d = table[i];
+        bool had_previous = d.last_status == ESP_OK;
+        int16_t previous_raw = d.last_raw;
+        uint32_t previous_cycle = d.read_cycle;
+        int16_t raw = 0;
+        esp_err_t err;
+
+        r.freshness = READING_FRESH;
+        r.sequence = cycle;
+        r.convert_us = d.convert_us;
+        r.read_us = 0;
+        if (d.convert_cycle != cycle) { // nothing to read, don't spend bus time on it
+            r.freshness = READING_STALE;
+            if (defer_invalid) return ESP_ERR_INVALID_STATE;
+            table.record_reading(i, ESP_ERR_INVALID_STATE, 0);
+            track_health(i, had_previous, ESP_ERR_INVALID_STATE);
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        bool full = force_full || policy.length == READ_FULL;
+        if (!full) {
+            err = get_temperature_raw_partial(table.bus(), &d.address, policy.length, d.config.resolution, &raw);
+            if (err == ESP_OK) {
+                int32_t step = static_cast<int32_t>(raw) - d.last_raw;
+                if (step < 0) step = -step;
+                full = raw < policy.min_raw || raw > policy.max_raw || (policy.max_step && had_previous && step > policy.max_step)
+                    || raw == DS18B20_POWER_ON_RAW; // only the full scratchpad tells the power-on value from a real 85 degrees C
+            } else {
+                full = true;
+            }
+        }
+        if (full) err = get_temperature_checked(table.bus(), &d.address, &raw, &r.freshness);
+        for (uint8_t retry = 0; is_retryable(err) && retry < config.retry.read_retries
+                && esp_timer_get_time() < deadline_us; retry++) {
+            err = get_temperature_checked(table.bus(), &d.address, &raw, &r.freshness);
+        }
+        r.read_us = esp_timer_get_time();
+        if (err == ESP_OK && r.freshness != READING_FRESH) {
+            err = ESP_ERR_INVALID_STATE;
+            if (defer_invalid) return err;
+        }
+
+        table.record_reading(i, err, raw);
+        track_health(i, had_previous, err);
+        if (err == ESP_OK) {
+            r.raw = calibrate(raw, d.calibration);
+            r.temperature = r.raw / 16.0f;
+            if (config.adaptive.enabled && had_previous) adapt(i, previous_raw, previous_cycle);
+            table[i].read_cycle = cycle;
+        }
+        return err;
+    }
+
+    /// @brief Check whether a device has to be read in this cycle: stable devices are read every slow_every cycles only
+    /// @param i Device index
+    /// @return True if due
+    bool Poller::is_due(size_t i) const
+    {
+        const adaptive_policy_t& policy = config.adaptive;
+        const device_t& d = table[i];
+        if (is_held(i)) return false;
+        if (!policy.enabled || policy.slow_every <= 1) return true;
+        if (d.last_status != ESP_OK || d.stable_count < policy.stable_cycles) return true;
+        return cycle - d.read_cycle >= policy.slow_every;
+    }
+
+    /// @brief Check whether a device is held by a backoff or quarantine
+    /// @param i Device index
+    /// @return True if the device must not be read in this cycle
+    bool Poller::is_held(size_t i) const
+    {
+        return static_cast<int32_t>(cycle - table[i].hold_until) < 0;
+    }
+
+    /// @brief Update the failure streak, backoff and quarantine of a device after a read
+    /// @param i Device index
+    /// @param was_good The previous read succeeded
+    /// @param err Read result
+    void Poller::track_health(size_t i, bool was_good, esp_err_t err)
+    {
+        const retry_policy_t& policy = config.retry;
+        device_t& d = table[i];
+        if (err == ESP_OK) {
+            d.fail_streak = 0;
+            d.quarantined = false;
+            return;
+        }
+
+        if (d.fail_streak < UINT16_MAX) d.fail_streak++;
+        if (policy.backoff_cycles) {
+            uint32_t shift = d.fail_streak - 1;
+            uint32_t hold = shift < 16 ? static_cast<uint32_t>(policy.backoff_cycles) << shift : UINT32_MAX;
+            if (policy.backoff_max_cycles && hold > policy.backoff_max_cycles) hold = policy.backoff_max_cycles;
+            if (hold > INT32_MAX) hold = INT32_MAX;
+            d.hold_until = cycle + 1 + hold;
+        }
+        if (policy.quarantine_flaps && was_good) {
+            if (cycle - d.flap_cycle > policy.flap_window_cycles) {
+                d.flap_cycle = cycle;
+                d.flap_count = 0;
+            }
+            if (++d.flap_count >= policy.quarantine_flaps) {
+                DS18B20_LOGW(TAG, "device with rom id %" PRIu64 " is flapping, quarantined", d.address);
+                d.flap_count = 0;
+                d.quarantined = true;
+                d.hold_until = cycle + 1 + policy.quarantine_cycles;
+            }
+        }
+    }
+
+    /// @brief Promote a device whose temperature moves to the high resolution, demote it to the low one after
+    /// stable_cycles readings without significant change. Takes effect with the next conversion.
+    /// @param i Device index, just read successfully
+    /// @param previous_raw Previous reading
+    /// @param previous_cycle Cycle of the previous reading
+    void Poller::adapt(size_t i, int16_t previous_raw, uint32_t previous_cycle)
+    {
+        const adaptive_policy_t& policy = config.adaptive;
+        device_t& d = table[i];
+        uint32_t cycles = cycle - previous_cycle;
+        if (cycles == 0) cycles = 1;
+        int32_t step = static_cast<int32_t>(d.last_raw) - previous_raw;
+        if (step < 0) step = -step;
+
+        resolution_t target;
+        if (static_cast<uint32_t>(step) > policy.promote_step * cycles) {
+            d.stable_count = 0;
+            target = policy.high_resolution;
+        } else {
+            if (d.stable_count < UINT16_MAX) d.stable_count++;
+            if (d.stable_count < policy.stable_cycles) return;
+            target = policy.low_resolution;
+        }
+        if (d.config_valid && d.config.resolution == target) return;
+
+        esp_err_t err = table.set_resolution(i, target);
+        if (err != ESP_OK) DS18B20_LOGW(TAG, "error while changing resolution: %s", esp_err_to_name(err));
+    }
+
+    /// @brief Run Alarm Search and read only the alarmed devices
+    /// @param force_full Skip partial reads
+    /// @param deadline_us See read_device
+    /// @return Number of readings
+    size_t Poller::read_alarmed(bool force_full, int64_t deadline_us)
+    {
+        search_context_t search;
+        search_begin(&search, ONEWIRE_CMD_SEARCH_ALARM);
+
+        size_t n = 0;
+        do {
+            onewire_device_address_t address;
+            esp_err_t err = search_next(table.bus(), &search, &address);
+            if (err == ESP_ERR_NOT_FOUND) break; // no (more) alarmed devices
+            if (err != ESP_OK) {
+                DS18B20_LOGW(TAG, "alarm search error: %s", esp_err_to_name(err));
+                break;
+            }
+            int i = table.find(address);
+            if (i < 0) continue; // not in the table, left for hot-plug search
+            if (is_held(i)) continue;
+            // the search is resumed after the read: its state is only ROM bits and the last discrepancy, not bus state
+            readings[n].index = i;
+            readings[n].status = read_device(i, force_full, readings[n], config.reconvert, deadline_us);
+            n++;
+        } while (!search.last_device && n < table.size());
+
+        return n;
+    }
+
+    /// @brief Convert due devices group by group, each group is read while the next one converts.
+    /// Externally powered devices only: a converting device doesn't load the bus, so others can be read meanwhile.
+    /// @param force_full Skip partial reads
+    /// @param deadline_us See read_device
+    /// @return Number of readings
+    size_t Poller::read_pipelined(bool force_full, int64_t deadline_us)
+    {
+        size_t count = 0; // readings queued by conversion
+        size_t done = 0; // readings read
+        size_t next = 0; // next device to convert
+        int64_t previous_ready = 0;
+
+        while (done < count || next < table.size()) {
+            size_t group_start = count;
+            uint32_t wait_us = 0;
+            for (size_t in_group = 0; next < table.size() && in_group < config.pipeline_group_size; next++) {
+                if (!is_due(next)) continue;
+                readings[count].index = next;
+                if (convert_device(next) == ESP_OK) {
+                    uint32_t t = table.conversion_time_us(next);
+                    if (t > wait_us) wait_us = t;
+                }
+                count++;
+                in_group++;
+            }
+            int64_t ready = esp_timer_get_time() + wait_us;
+
+            // read the previous group while this one converts
+            int64_t left = previous_ready - esp_timer_get_time();
+            if (done < group_start && left > 0) wait_conversion(left);
+            for (; done < group_start; done++) {
+                readings[done].status = read_device(readings[done].index, force_full, readings[done], config.reconvert, deadline_us);
+            }
+            previous_ready = ready;
+        }
+
+        return count;
+    }
+
+    /// @brief Convert again and read only the devices whose reading was the power-on value or missed the conversion
+    /// @param count Number of readings of this cycle
+    /// @param force_full Skip partial reads
+    /// @param deadline_us See read_device
+    void Poller::reconvert(size_t count, bool force_full, int64_t deadline_us)
+    {
+        onewire_bus_handle_t bus = table.bus();
+        bool pullup = has_strong_pullup(bus);
+        uint32_t wait_us = 0;
+        bool any = false;
+        for (size_t k = 0; k < count; k++) {
+            if (readings[k].status != ESP_ERR_INVALID_STATE) continue;
+            any = true;
+            device_t& d = table[readings[k].index];
+            // a reset device reloaded TH, TL and resolution from EEPROM, restore the cached configuration first
+            if (readings[k].freshness == READING_POWER_ON && d.config_valid && !d.config_saved) {
+                esp_err_t err = set_config(bus, &d.address, &d.config);
+                if (err != ESP_OK) DS18B20_LOGW(TAG, "error while restoring configuration: %s", esp_err_to_name(err));
+            }
+            uint32_t t = table.conversion_time_us(readings[k].index);
+            if (d.power_mode != POWER_EXTERNAL && pullup) { // powered by the strong pull-up, as in convert()
+                bool engaged;
+                lock_bus(bus, UINT32_MAX); // no traffic while the pull-up holds the line
+                esp_err_t err = trigger_conversion_with_pullup(bus, &d.address, &engaged);
+                if (err == ESP_OK && engaged) {
+                    d.convert_us = esp_timer_get_time();
+                    wait_conversion(t);
+                    err = strong_pullup(bus, false);
+                }
+                unlock_bus(bus);
+                if (err == ESP_OK && !engaged) err = ESP_FAIL;
+                if (err != ESP_OK) DS18B20_LOGW(TAG, "error while converting with strong pull-up: %s", esp_err_to_name(err));
+                continue;
+            }
+            if (convert_device(readings[k].index) != ESP_OK) continue;
+            if (d.power_mode != POWER_EXTERNAL) {
+                wait_conversion(t); // parasite-powered devices convert one at a time
+            } else if (t > wait_us) {
+                wait_us = t;
+            }
+        }
+        if (!any) return;
+
+        if (wait_us) wait_conversion(wait_us);
+        for (size_t k = 0; k < count; k++) {
+            if (readings[k].status != ESP_ERR_INVALID_STATE) continue;
+            size_t i = readings[k].index;
+            // a pull-up conversion that failed left the conversion time as it was, a re-read would return the same data
+            if (table[i].power_mode != POWER_EXTERNAL && pullup && table[i].convert_us == readings[k].convert_us) {
+                bool had_previous = table[i].last_status == ESP_OK;
+                table.record_reading(i, ESP_ERR_INVALID_STATE, 0);
+                track_health(i, had_previous, ESP_ERR_INVALID_STATE);
+                continue;
+            }
+            readings[k].status = read_device(i, force_full, readings[k], false, deadline_us);
+        }
+    }
+
+    void Poller::publish(size_t count)
+    {
+        if (config.queue) {
+            for (size_t i = 0; i < count; i++) {
+                if (xQueueSend(config.queue, &readings[i], 0) != pdTRUE) {
+                    DS18B20_LOGW(TAG, "reading queue full");
+                    break;
+                }
+            }
+        }
+        if (config.ring) {
+            for (size_t i = 0; i < count; i++) {
+                sample_t sample = {
+                    .timestamp_us = readings[i].read_us,
+                    .convert_us = readings[i].convert_us,
+                    .sequence = readings[i].sequence,
+                    .index = static_cast<uint16_t>(readings[i].index),
+                    .raw = readings[i].raw,
+                    .status = static_cast<int16_t>(readings[i].status),
+                };
+                config.ring->push(sample);
+            }
+        }
+        if (config.callback) config.callback(readings, count, config.callback_ctx);
+    }
+
+    void Poller::task_body(void* arg)
+    {
+        Poller* self = static_cast<Poller*>(arg);
+        TickType_t period = pdMS_TO_TICKS(self->config.period_ms);
+
+        while (!self->stop_requested) {
+            TickType_t cycle_start = xTaskGetTickCount();
+            self->run_cycle_until(self->cycle_deadline_us(esp_timer_get_time())); // one deadline for the whole cycle
+            // wait for the rest of the period, stop() interrupts the wait
+            TickType_t elapsed = xTaskGetTickCount() - cycle_start;
+            if (elapsed < period) ulTaskNotifyTake(pdTRUE, period - elapsed);
+        }
+
+        TaskHandle_t waiter = self->stop_waiter;
+        self->task = NULL;
+        if (waiter) xTaskNotifyGive(waiter);
+        vTaskDelete(NULL);
+    }
+} // namespace ds18b20
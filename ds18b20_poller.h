@@ -0,0 +1,262 @@
+/**
+ * @file ds18b20_poller.h
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Non-blocking whole-bus conversion scheduler for DS18B20.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "ds18b20.h"
+#include "ds18b20_registry.h"
+#include "ds18b20_ring.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include <stddef.h>
+
+namespace ds18b20
+{
+    typedef struct {
+        size_t index; /*!< index of the device in the device table */
+        float temperature; /*!< calibrated temperature, valid only if status is ESP_OK */
+        int16_t raw; /*!< calibrated temperature (see device_t::calibration), 1/16 degrees C, valid only if status is ESP_OK */
+        esp_err_t status; /*!< result of the scratchpad read, ESP_ERR_INVALID_STATE if the reading isn't a fresh conversion result */
+        reading_class_t freshness; /*!< why the reading isn't fresh, valid if status is ESP_OK or ESP_ERR_INVALID_STATE */
+        int64_t convert_us; /*!< esp_timer time of the Convert T command the reading is the result of, 0 if none */
+        int64_t read_us; /*!< esp_timer time of the read completion, 0 if the device wasn't read */
+        uint32_t sequence; /*!< poller cycle number, the same for every reading of a cycle */
+    } reading_t;
+
+    typedef struct {
+        read_length_t length; /*!< scratchpad bytes to read in a regular cycle */
+        uint16_t crc_every; /*!< do a full CRC-checked read every Nth cycle, 0 to never force it */
+        int16_t min_raw; /*!< a partial reading below this (1/16 degrees C) is re-read in full */
+        int16_t max_raw; /*!< a partial reading above this (1/16 degrees C) is re-read in full */
+        uint16_t max_step; /*!< a partial reading that differs from the previous one more than this is re-read in full, 0 to disable */
+    } read_policy_t;
+
+#define DS18B20_READ_POLICY_DEFAULT() { \
+        .length = ds18b20::READ_FULL, \
+        .crc_every = 0, \
+        .min_raw = -55 * 16, \
+        .max_raw = 125 * 16, \
+        .max_step = 0, \
+    }
+
+    typedef struct {
+        bool enabled; /*!< adapt resolution and read rate of every sensor to how fast its temperature moves */
+        resolution_t low_resolution; /*!< resolution of stable sensors */
+        resolution_t high_resolution; /*!< resolution of moving sensors */
+        uint16_t promote_step; /*!< change per cycle (1/16 degrees C) that makes a sensor moving, keep above the low resolution step */
+        uint16_t stable_cycles; /*!< consecutive readings below promote_step that make a sensor stable */
+        uint16_t slow_every; /*!< stable sensors are read every Nth cycle only, 0 or 1 to read them every cycle */
+    } adaptive_policy_t;
+
+#define DS18B20_ADAPTIVE_POLICY_DEFAULT() { \
+        .enabled = false, \
+        .low_resolution = ds18b20::RESOLUTION_10B, \
+        .high_resolution = ds18b20::RESOLUTION_12B, \
+        .promote_step = 4, \
+        .stable_cycles = 10, \
+        .slow_every = 4, \
+    }
+
+    typedef struct {
+        uint8_t read_retries; /*!< immediate scratchpad re-reads after a CRC error or missing presence pulse, the conversion is not repeated */
+        uint32_t cycle_budget_us; /*!< time from the start of a cycle after which failed reads are not retried, so that a flaky device
+                                       can't delay the others past their slot, 0 for period_ms */
+        uint16_t backoff_cycles; /*!< skip a failed device for this many cycles, doubled with every consecutive failure, 0 to disable */
+        uint16_t backoff_max_cycles; /*!< backoff limit, 0 for no limit */
+        uint16_t quarantine_flaps; /*!< good to failed transitions within flap_window_cycles that quarantine a device, 0 to disable */
+        uint16_t flap_window_cycles; /*!< flap counting window */
+        uint16_t quarantine_cycles; /*!< cycles a quarantined device is not read */
+    } retry_policy_t;
+
+#define DS18B20_RETRY_POLICY_DEFAULT() { \
+        .read_retries = 0, \
+        .cycle_budget_us = 0, \
+        .backoff_cycles = 0, \
+        .backoff_max_cycles = 64, \
+        .quarantine_flaps = 0, \
+        .flap_window_cycles = 100, \
+        .quarantine_cycles = 600, \
+    }
+
+    typedef struct {
+        bool light_sleep; /*!< enter light sleep for conversion waits, requires CONFIG_DS18B20_LIGHT_SLEEP */
+        int bus_gpio; /*!< 1-wire data GPIO, held across sleep so that the line can't glitch low and reset the devices, -1 if none */
+        int pullup_gpio; /*!< strong pull-up control GPIO, held across sleep so that parasite-powered devices keep power, -1 if none */
+        uint32_t min_sleep_us; /*!< shorter waits use vTaskDelay, sleep entry and exit aren't worth it */
+    } sleep_policy_t;
+
+#define DS18B20_SLEEP_POLICY_DEFAULT() { \
+        .light_sleep = false, \
+        .bus_gpio = -1, \
+        .pullup_gpio = -1, \
+        .min_sleep_us = 20000, \
+    }
+
+    /**
+     * @brief Poller cycle completion callback, called from the poller task
+     *
+     * @param[in] readings One reading per device, in device table order
+     * @param[in] count Number of readings
+     * @param[in] ctx User context from poller_config_t
+     */
+    typedef void (*poller_callback_t)(const reading_t* readings, size_t count, void* ctx);
+
+    typedef struct {
+        uint32_t period_ms; /*!< cycle period, 0 to start next cycle right after the previous one */
+        bool poll_completion; /*!< poll read time slots to finish as soon as devices are done instead of waiting worst-case time */
+        uint32_t poll_interval_ms; /*!< yield between completion polls (externally powered buses only) */
+        size_t parasite_group_size; /*!< parasite-powered devices converted at once when no strong pull-up is registered */
+        size_t pipeline_group_size; /*!< externally powered buses: convert groups of this many devices in turn, each while the previous group is read, 0 to broadcast */
+        read_policy_t read_policy; /*!< scratchpad read length and CRC policy */
+        adaptive_policy_t adaptive; /*!< per-sensor resolution and read rate, readings are published only for the sensors read */
+        retry_policy_t retry; /*!< re-reads, backoff and quarantine of failing sensors, held sensors are not read or published */
+        bool reconvert; /*!< convert and read again, in the same cycle, only the sensors that returned the power-on value or missed the conversion */
+        sleep_policy_t sleep; /*!< light sleep instead of a task delay while devices convert, for battery-powered nodes */
+        bool alarm_only; /*!< after the conversion, read and publish only devices found by Alarm Search */
+        uint16_t search_every; /*!< advance hot-plug search by one device every Nth cycle, 0 to disable */
+        table_delta_callback_t delta_callback; /*!< called for devices added or removed by hot-plug search, can be NULL */
+        poller_callback_t callback; /*!< called after every cycle, can be NULL */
+        void* callback_ctx; /*!< passed to callback and delta_callback */
+        QueueHandle_t queue; /*!< receives every reading_t without blocking, can be NULL */
+        SampleRing* ring; /*!< receives a sample_t for every reading, can be NULL */
+        uint32_t task_stack_size; /*!< poller task stack size, bytes */
+        UBaseType_t task_priority; /*!< poller task priority */
+        BaseType_t task_core; /*!< core to pin poller task to, tskNO_AFFINITY to let the scheduler decide */
+    } poller_config_t;
+
+#define DS18B20_POLLER_DEFAULT_CONFIG() { \
+        .period_ms = 1000, \
+        .poll_completion = false, \
+        .poll_interval_ms = 10, \
+        .parasite_group_size = 1, \
+        .pipeline_group_size = 0, \
+        .read_policy = DS18B20_READ_POLICY_DEFAULT(), \
+        .adaptive = DS18B20_ADAPTIVE_POLICY_DEFAULT(), \
+        .retry = DS18B20_RETRY_POLICY_DEFAULT(), \
+        .reconvert = true, \
+        .sleep = DS18B20_SLEEP_POLICY_DEFAULT(), \
+        .alarm_only = false, \
+        .search_every = 0, \
+        .delta_callback = NULL, \
+        .callback = NULL, \
+        .callback_ctx = NULL, \
+        .queue = NULL, \
+        .ring = NULL, \
+        .task_stack_size = 3072, \
+        .task_priority = 5, \
+        .task_core = tskNO_AFFINITY, \
+    }
+
+    /**
+     * @brief Whole-bus poller: one broadcast (SKIP ROM) Convert T per cycle, a single conversion wait
+     * long enough for the slowest device, then all scratchpads are read and the results are posted.
+     * Buses with parasite-powered devices use a strong pull-up (see ds18b20::set_strong_pullup()) or grouped conversion.
+     * Externally powered buses can be pipelined instead (see poller_config_t::pipeline_group_size): MATCH ROM Convert T
+     * is sent to one group while the scratchpads of the previous group are read, so the bus isn't idle for the
+     * conversion time and every device is sampled at a steady interval.
+     * The device table and buffers are owned by the caller and must outlive the poller.
+     */
+    class Poller
+    {
+    public:
+        /**
+         * @brief Create a poller and register its bus (see ds18b20::register_bus()), does not touch the bus
+         *
+         * @param[in] table Devices to poll, e.g. filled with DeviceTable::scan(). Readings are recorded in the table.
+         * @param[out] readings Result buffer (table.capacity() entries)
+         * @param[in] config Poller configuration
+         */
+        Poller(DeviceTable& table, reading_t* readings, const poller_config_t& config);
+        ~Poller();
+
+        Poller(const Poller&) = delete;
+        Poller& operator=(const Poller&) = delete;
+
+        /**
+         * @brief Start poller task
+         *
+         * @return
+         *         - ESP_OK                Poller started.
+         *         - ESP_ERR_INVALID_ARG   Invalid constructor arguments.
+         *         - ESP_ERR_INVALID_STATE Already running.
+         *         - ESP_ERR_NO_MEM        Failed to create the task.
+         */
+        esp_err_t start();
+
+        /**
+         * @brief Stop poller task, blocks until the current cycle is finished
+         *
+         * @return
+         *         - ESP_OK                Poller stopped.
+         *         - ESP_ERR_INVALID_STATE Not running.
+         */
+        esp_err_t stop();
+
+        /**
+         * @brief Run a single cycle in the calling task (blocks for the conversion time), the cycle budget
+         * (see retry_policy_t::cycle_budget_us) starts with the call
+         *
+         * @return
+         *         - ESP_OK                Conversion triggered, per-device results are in the readings buffer.
+         *         - ESP_ERR_INVALID_ARG   Invalid constructor arguments.
+         *         - ESP_ERR_NOT_SUPPORTED Light sleep requested without CONFIG_DS18B20_LIGHT_SLEEP.
+         *         - Otherwise see ds18b20::trigger_temperature_conversion().
+         */
+        esp_err_t run_cycle();
+
+        bool is_running() const { return task != NULL; }
+        const reading_t* results() const { return readings; }
+        size_t result_count() const { return last_count; }
+        DeviceTable& devices() { return table; }
+
+    private:
+        DeviceTable& table;
+        reading_t* readings;
+        poller_config_t config;
+        uint32_t cycle;
+        size_t last_count;
+        TaskHandle_t task;
+        TaskHandle_t stop_waiter;
+        volatile bool stop_requested;
+        bool registered;
+
+        esp_err_t convert();
+        void wait_conversion(uint32_t us);
+        void mark_converted(int64_t convert_us);
+        esp_err_t convert_device(size_t i);
+        esp_err_t run_cycle_until(int64_t deadline_us);
+        int64_t cycle_deadline_us(int64_t start_us) const;
+        esp_err_t read_device(size_t i, bool force_full, reading_t& r, bool defer_invalid, int64_t deadline_us);
+        void reconvert(size_t count, bool force_full, int64_t deadline_us);
+        bool is_due(size_t i) const;
+        bool is_held(size_t i) const;
+        void track_health(size_t i, bool was_good, esp_err_t err);
+        void adapt(size_t i, int16_t previous_raw, uint32_t previous_cycle);
+        size_t read_alarmed(bool force_full, int64_t deadline_us);
+        size_t read_pipelined(bool force_full, int64_t deadline_us);
+        void publish(size_t count);
+        static void task_body(void* arg);
+    };
+} // namespace ds18b20
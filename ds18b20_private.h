@@ -0,0 +1,191 @@
+/**
+ * @file ds18b20_private.h
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Internals shared between DS18B20 library modules, not part of the public API.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "ds18b20.h"
+
+#include "sdkconfig.h"
+#include "esp_check.h"
+#include "esp_compiler.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#if CONFIG_DS18B20_QUIET
+// error paths are bare returns, errors are only counted in the per-bus statistics
+#define DS18B20_RETURN_ON_ERROR(x, log_tag, format, ...) do { \
+        esp_err_t err_rc_ = (x); \
+        (void)(log_tag); \
+        if (unlikely(err_rc_ != ESP_OK)) return err_rc_; \
+    } while (0)
+#define DS18B20_RETURN_ON_FALSE(a, err_code, log_tag, format, ...) do { \
+        (void)(log_tag); \
+        if (unlikely(!(a))) return err_code; \
+    } while (0)
+#define DS18B20_LOGE(tag, format, ...) do { (void)(tag); } while (0)
+#define DS18B20_LOGW(tag, format, ...) do { (void)(tag); } while (0)
+#define DS18B20_LOGI(tag, format, ...) do { (void)(tag); } while (0)
+#define DS18B20_LOGD(tag, format, ...) do { (void)(tag); } while (0)
+#else
+#define DS18B20_RETURN_ON_ERROR(x, log_tag, format, ...) ESP_RETURN_ON_ERROR(x, log_tag, format, ##__VA_ARGS__)
+#define DS18B20_RETURN_ON_FALSE(a, err_code, log_tag, format, ...) ESP_RETURN_ON_FALSE(a, err_code, log_tag, format, ##__VA_ARGS__)
+#define DS18B20_LOGE(tag, format, ...) ESP_LOGE(tag, format, ##__VA_ARGS__)
+#define DS18B20_LOGW(tag, format, ...) ESP_LOGW(tag, format, ##__VA_ARGS__)
+#define DS18B20_LOGI(tag, format, ...) ESP_LOGI(tag, format, ##__VA_ARGS__)
+#define DS18B20_LOGD(tag, format, ...) ESP_LOGD(tag, format, ##__VA_ARGS__)
+#endif
+
+namespace ds18b20
+{
+    typedef struct {
+        onewire_bus_handle_t handle; /*!< bus the settings are for, NULL for a free slot */
+        strong_pullup_t strong_pullup; /*!< strong pull-up control, can be NULL */
+        void* strong_pullup_ctx; /*!< passed to strong_pullup */
+        bool strong_pullup_armed; /*!< strong_pullup is enabled before the command write, see set_strong_pullup() */
+        search_triplet_t search_triplet; /*!< hardware search triplet, can be NULL */
+        void* search_triplet_ctx; /*!< passed to search_triplet */
+        uint32_t users; /*!< references, see register_bus(), the slot is freed with the last one */
+        portMUX_TYPE stats_lock; /*!< guards stats, counted from tasks on any core */
+        stats_t stats; /*!< error counters */
+        StaticSemaphore_t lock_buffer; /*!< storage of lock */
+        SemaphoreHandle_t lock; /*!< recursive transaction lock, NULL if the bus is not shared, see enable_bus_lock() */
+    } bus_context_t;
+
+    /**
+     * @brief Find per-bus settings, slots are only taken by register_bus() and the setters of per-bus settings
+     *
+     * @param[in] handle 1-wire handle
+     * @return Bus context or NULL if the bus is not registered
+     */
+    bus_context_t* get_bus_context(onewire_bus_handle_t handle);
+
+    /**
+     * @brief Holds the bus lock for the scope of a transaction, no-op for buses without a lock.
+     * The lock is recursive, so transactions nest inside a lock_bus() of the caller.
+     */
+    class BusLock
+    {
+    public:
+        explicit BusLock(onewire_bus_handle_t handle);
+        ~BusLock();
+
+        BusLock(const BusLock&) = delete;
+        BusLock& operator=(const BusLock&) = delete;
+
+    private:
+        SemaphoreHandle_t mutex;
+    };
+
+    /**
+     * @brief Count an error in the statistics of the bus where it originated
+     *
+     * @param[in] handle 1-wire handle
+     * @param[in] err Error
+     */
+    void count_error(onewire_bus_handle_t handle, esp_err_t err);
+
+    /**
+     * @brief Count a library transaction in the statistics of a registered bus, no-op without CONFIG_DS18B20_BUS_STATS
+     *
+     * @param[in] handle 1-wire handle
+     * @param[in] counter Counter in stats_t
+     */
+    static inline void count_transaction(onewire_bus_handle_t handle, uint32_t stats_t::* counter)
+    {
+#if CONFIG_DS18B20_BUS_STATS
+        bus_context_t* ctx = get_bus_context(handle);
+        if (!ctx) return;
+        portENTER_CRITICAL(&ctx->stats_lock);
+        ctx->stats.*counter += 1;
+        portEXIT_CRITICAL(&ctx->stats_lock);
+#else
+        (void)handle;
+        (void)counter;
+#endif
+    }
+
+    /**
+     * @brief Bus primitives used by the library instead of onewire_bus_*(): errors are counted where they originate,
+     * calls are counted and timed with CONFIG_DS18B20_BUS_STATS
+     */
+    esp_err_t bus_reset(onewire_bus_handle_t handle);
+    esp_err_t bus_write_bytes(onewire_bus_handle_t handle, const uint8_t* tx_data, uint8_t tx_data_size);
+    esp_err_t bus_read_bytes(onewire_bus_handle_t handle, uint8_t* rx_buf, size_t rx_buf_size);
+    esp_err_t bus_write_bit(onewire_bus_handle_t handle, uint8_t tx_bit);
+    esp_err_t bus_read_bit(onewire_bus_handle_t handle, uint8_t* rx_bit);
+
+    /**
+     * @brief Check whether a strong pull-up is registered for the bus
+     *
+     * @param[in] handle 1-wire handle
+     * @return True if registered
+     */
+    bool has_strong_pullup(onewire_bus_handle_t handle);
+
+    /**
+     * @brief Enable or release the strong pull-up of the bus
+     *
+     * @param[in] handle 1-wire handle
+     * @param[in] enable Enable or release
+     * @return
+     *         - ESP_OK                Done.
+     *         - ESP_ERR_NOT_SUPPORTED No strong pull-up registered.
+     *         - Otherwise             Callback error.
+     */
+    esp_err_t strong_pullup(onewire_bus_handle_t handle, bool enable);
+
+    /**
+     * @brief Write a command and engage the strong pull-up right after it, the caller releases it with strong_pullup()
+     *
+     * @param[in] handle 1-wire handle
+     * @param[in] tx_data Command
+     * @param[in] tx_data_size Command length
+     * @param[out] engaged Strong pull-up is engaged
+     * @return
+     *         - ESP_OK                Command written, engaged tells whether the pull-up is on.
+     *         - Otherwise             See onewire_bus_write_bytes(), the pull-up is off.
+     */
+    esp_err_t write_with_pullup(onewire_bus_handle_t handle, const uint8_t* tx_data, uint8_t tx_data_size, bool* engaged);
+
+    /**
+     * @brief Convert T with the strong pull-up engaged right after it, the caller releases it with strong_pullup()
+     *
+     * @param[in] handle 1-wire handle
+     * @param[in] rom_number ROM number of the device to convert, NULL to broadcast
+     * @param[out] engaged Strong pull-up is engaged
+     * @return See trigger_temperature_conversion()
+     */
+    esp_err_t trigger_conversion_with_pullup(onewire_bus_handle_t handle, const onewire_device_address_t* rom_number, bool* engaged);
+
+    /**
+     * @brief Check that a device with the given ROM is present using a single directed search pass
+     *
+     * @param[in] handle 1-wire handle
+     * @param[in] address ROM number
+     * @return
+     *         - ESP_OK                Device is present.
+     *         - ESP_ERR_NOT_FOUND     Device is not present.
+     *         - Otherwise see ds18b20::search_next().
+     */
+    esp_err_t verify(onewire_bus_handle_t handle, onewire_device_address_t address);
+} // namespace ds18b20
@@ -0,0 +1,654 @@
+/**
+ * @file ds18b20_registry.cpp
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Per-bus DS18B20 device table with cached device state.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ds18b20_registry.h"
+
+#include "esp_check.h"
+#include "esp_timer.h"
+#include "onewire_cmd.h"
+
+#define DS18B20_TABLE_IMAGE_MAGIC 0x18B2 // little endian in the first two bytes of an image
+#define DS18B20_TABLE_IMAGE_HEADER 6 // magic, version, record size, device count
+#define DS18B20_TABLE_IMAGE_RECORD 16 // ROM, TH, TL, resolution, flags, calibration offset and gain
+#define DS18B20_TABLE_FLAG_CONFIG 0x01 // TH, TL and resolution are in EEPROM
+#define DS18B20_TABLE_POWER_SHIFT 1 // power_mode_t in bits 1-2 of flags
+
+#define DS18B20_OFFSET_BIAS -92 // TL of a zero offset, TL stays below -55 degrees C with any stored offset
+
+namespace ds18b20
+{
+    static const char *TAG = "ds18b20_registry";
+
+    DeviceTable::DeviceTable(onewire_bus_handle_t handle, device_t* storage, size_t capacity)
+        : handle(handle), devices(storage), max_count(storage ? capacity : 0), count(0), pass(1), pass_clean(true),
+          aggregates(NULL), ewma_shift(0)
+    {
+        search_begin(&search, ONEWIRE_CMD_SEARCH_NORMAL);
+    }
+
+    /// @brief Add a device with unknown configuration
+    /// @param address ROM number
+    /// @param index Index output buffer (can be NULL)
+    /// @return ESP_OK if added or already known, ESP_ERR_NO_MEM if the table is full
+    esp_err_t DeviceTable::add(onewire_device_address_t address, size_t* index)
+    {
+        int existing = find(address);
+        if (existing >= 0) {
+            if (index) *index = existing;
+            return ESP_OK;
+        }
+        DS18B20_RETURN_ON_FALSE(count < max_count, ESP_ERR_NO_MEM, TAG, "device table full");
+
+        device_t& d = devices[count];
+        d.address = address;
+        d.config.th = 0;
+        d.config.tl = 0;
+        d.config.resolution = RESOLUTION_12B;
+        d.config_valid = false;
+        d.config_saved = false;
+        d.power_mode = POWER_UNKNOWN;
+        d.last_raw = 0;
+        d.last_status = ESP_ERR_NOT_FINISHED;
+        d.read_count = 0;
+        d.error_count = 0;
+        d.last_seen_us = 0;
+        d.search_pass = pass; // don't remove a device added in the middle of a pass
+        d.missed_passes = 0;
+        d.read_cycle = 0;
+        d.convert_cycle = UINT32_MAX;
+        d.convert_us = 0;
+        d.stable_count = 0;
+        d.fail_streak = 0;
+        d.flap_count = 0;
+        d.flap_cycle = 0;
+        d.hold_until = 0;
+        d.quarantined = false;
+        d.calibration = DS18B20_CALIBRATION_NONE();
+        if (aggregates) aggregates[count] = {};
+        if (index) *index = count;
+        count++;
+
+        return ESP_OK;
+    }
+
+    void DeviceTable::remove(size_t index)
+    {
+        if (index >= count) return;
+        devices[index] = devices[--count];
+        if (aggregates) aggregates[index] = aggregates[count];
+    }
+
+    int DeviceTable::find(onewire_device_address_t address) const
+    {
+        for (size_t i = 0; i < count; i++) {
+            if (devices[i].address == address) return static_cast<int>(i);
+        }
+        return -1;
+    }
+
+    /// @brief Run search steps until a pass is complete, then read configuration of the new devices
+    /// @param callback Delta callback (can be NULL)
+    /// @param ctx Callback context
+    /// @return ESP_OK if succeeded, ESP_ERR_NO_MEM if the table is full, otherwise see search_step and refresh
+    esp_err_t DeviceTable::scan(table_delta_callback_t callback, void* ctx)
+    {
+        DS18B20_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "invalid 1-wire handle");
+
+        // start from the beginning, so that a pass in progress won't be completed by half a search
+        search_begin(&search, ONEWIRE_CMD_SEARCH_NORMAL);
+        pass++;
+        pass_clean = true;
+
+        esp_err_t ret = ESP_OK;
+        bool pass_done = false;
+        while (!pass_done) {
+            esp_err_t err = search_step(callback, ctx, &pass_done);
+            if (err == ESP_ERR_NO_MEM) {
+                ret = err;
+            } else if (err != ESP_OK) {
+                DS18B20_LOGE(TAG, "search error: %s", esp_err_to_name(err));
+                return err;
+            }
+        }
+        DS18B20_LOGI(TAG, "%u device%s on 1-wire bus", static_cast<unsigned>(count), count != 1 ? "s" : "");
+
+        esp_err_t err = refresh(false);
+        return ret == ESP_OK ? err : ret;
+    }
+
+    /// @brief Find the next device of the resumable search
+    /// @param callback Delta callback (can be NULL)
+    /// @param ctx Callback context
+    /// @param pass_done Pass completion output (can be NULL)
+    /// @return ESP_OK if succeeded, ESP_ERR_NO_MEM if the table is full, otherwise see search_next
+    esp_err_t DeviceTable::search_step(table_delta_callback_t callback, void* ctx, bool* pass_done)
+    {
+        if (pass_done) *pass_done = false;
+
+        onewire_device_address_t address;
+        esp_err_t err = search_next(handle, &search, &address);
+        if (err == ESP_ERR_NOT_FOUND) {
+            // empty bus, but also a reset without presence pulse or no response halfway: an incomplete pass
+            pass_clean = false;
+            finish_pass(callback, ctx);
+            if (pass_done) *pass_done = true;
+            return ESP_OK;
+        }
+        if (err != ESP_OK) {
+            // state is rewound (or the pass is broken), results of this pass can't be used for removal
+            search_begin(&search, ONEWIRE_CMD_SEARCH_NORMAL);
+            pass++;
+            pass_clean = true;
+            return err;
+        }
+
+        int known = find(address);
+        if (known < 0 && !is_supported_family(get_family(address))) {
+            DS18B20_LOGD(TAG, "skipping device with rom id %" PRIu64 " of family 0x%02x", address, get_family(address));
+        } else if (known >= 0) {
+            devices[known].search_pass = pass;
+            devices[known].last_seen_us = esp_timer_get_time();
+        } else {
+            size_t index;
+            err = add(address, &index);
+            if (err == ESP_OK) {
+                DS18B20_LOGD(TAG, "new device with rom id %" PRIu64, address);
+                refresh_device(index, false); // failure is retried by the next refresh()
+                if (callback) callback(devices[index], true, ctx);
+            } else {
+                pass_clean = false; // table is full, the pass is counted as incomplete
+            }
+        }
+
+        if (search.last_device) {
+            search_begin(&search, ONEWIRE_CMD_SEARCH_NORMAL);
+            finish_pass(callback, ctx);
+            if (pass_done) *pass_done = true;
+        }
+        return err;
+    }
+
+    /// @brief Remove devices not seen during the pass and start next pass. A clean pass removes them at once,
+    /// an incomplete one only after DS18B20_TABLE_MISSED_PASSES in a row, so a bus glitch doesn't empty the table.
+    /// @param callback Delta callback (can be NULL)
+    /// @param ctx Callback context
+    void DeviceTable::finish_pass(table_delta_callback_t callback, void* ctx)
+    {
+        for (size_t i = count; i-- > 0;) {
+            device_t& d = devices[i];
+            if (d.search_pass == pass) {
+                d.missed_passes = 0;
+                continue;
+            }
+            if (!pass_clean && ++d.missed_passes < DS18B20_TABLE_MISSED_PASSES) continue;
+            device_t removed = d;
+            remove(i);
+            DS18B20_LOGD(TAG, "device with rom id %" PRIu64 " is gone", removed.address);
+            if (callback) callback(removed, false, ctx);
+        }
+        pass++;
+        pass_clean = true;
+    }
+
+    /// @brief Check that a known device is still present with a MATCH ROM scratchpad read, an absent device reads as all ones
+    /// and fails the CRC. A configuration that differs from the cached one (e.g. after a power cycle) replaces it.
+    /// @param index Device index
+    /// @return ESP_OK if present, ESP_ERR_INVALID_ARG if index is out of range, otherwise see read_config
+    esp_err_t DeviceTable::check_presence(size_t index)
+    {
+        DS18B20_RETURN_ON_FALSE(index < count, ESP_ERR_INVALID_ARG, TAG, "invalid device index");
+
+        device_t& d = devices[index];
+        config_t config;
+        esp_err_t err = read_config(handle, &d.address, &config);
+        if (err != ESP_OK) return err;
+        d.last_seen_us = esp_timer_get_time();
+        d.search_pass = pass;
+        if (d.config_valid && (config.th != d.config.th || config.tl != d.config.tl || config.resolution != d.config.resolution)) {
+            DS18B20_LOGD(TAG, "device with rom id %" PRIu64 " lost its configuration", d.address);
+            d.config_saved = false;
+        }
+        d.config = config;
+        d.config_valid = true;
+        return ESP_OK;
+    }
+
+    /// @brief Read configuration and power supply mode of devices that don't have them cached
+    /// @param force Re-read all devices
+    /// @return ESP_OK if succeeded, otherwise first per-device error (see read_config)
+    esp_err_t DeviceTable::refresh(bool force)
+    {
+        esp_err_t ret = ESP_OK;
+        for (size_t i = 0; i < count; i++) {
+            esp_err_t err = refresh_device(i, force);
+            if (err != ESP_OK && ret == ESP_OK) ret = err;
+        }
+        return ret;
+    }
+
+    /// @brief Read configuration and power supply mode of one device if not cached
+    /// @param index Device index
+    /// @param force Re-read even if cached
+    /// @return ESP_OK if succeeded, otherwise see read_config and read_power_supply
+    esp_err_t DeviceTable::refresh_device(size_t index, bool force)
+    {
+        device_t& d = devices[index];
+        esp_err_t err = ESP_OK;
+        if (!d.config_valid || force) {
+            err = read_config(handle, &d.address, &d.config);
+            if (err == ESP_OK) d.config_valid = true;
+        }
+        if (err == ESP_OK && (d.power_mode == POWER_UNKNOWN || force)) {
+            err = read_power_supply(handle, &d.address, &d.power_mode);
+        }
+        if (err == ESP_OK) d.last_seen_us = esp_timer_get_time();
+        return err;
+    }
+
+    /// @brief Get the configuration a device ends up with, a DS18S20 keeps its fixed resolution
+    /// @param d Device
+    /// @param config Configuration written
+    /// @return Configuration to cache
+    static config_t normalize(const device_t& d, const config_t& config)
+    {
+        config_t normalized = config;
+        if (get_family(d.address) == FAMILY_DS18S20) normalized.resolution = RESOLUTION_12B; // see read_config()
+        return normalized;
+    }
+
+    /// @brief Write configuration, skipping the bus transaction if the cached configuration matches
+    /// @param index Device index
+    /// @param config Configuration
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if index is out of range, otherwise see set_config
+    esp_err_t DeviceTable::set_config(size_t index, const config_t& config)
+    {
+        DS18B20_RETURN_ON_FALSE(index < count, ESP_ERR_INVALID_ARG, TAG, "invalid device index");
+
+        device_t& d = devices[index];
+        config_t normalized = normalize(d, config);
+        if (d.config_valid && d.config.resolution == normalized.resolution && d.config.th == normalized.th && d.config.tl == normalized.tl) return ESP_OK;
+        DS18B20_RETURN_ON_ERROR(ds18b20::set_config(handle, &d.address, &normalized), TAG, "error while writing configuration");
+        d.config = normalized;
+        d.config_valid = true;
+        d.config_saved = false;
+
+        return ESP_OK;
+    }
+
+    /// @brief Check whether a device already has the configuration
+    /// @param d Device
+    /// @param config Configuration
+    /// @param persist Configuration has to be in EEPROM too
+    /// @return True if nothing has to be written
+    static bool config_matches(const device_t& d, const config_t& config, bool persist)
+    {
+        config_t normalized = normalize(d, config);
+        return d.config_valid && d.config.resolution == normalized.resolution && d.config.th == normalized.th && d.config.tl == normalized.tl &&
+            (d.config_saved || !persist);
+    }
+
+    /// @brief Write configuration to devices that need it, with a single broadcast if all of them do
+    /// @param config Configuration
+    /// @param persist Copy to EEPROM
+    /// @return ESP_OK if succeeded, otherwise first per-device error (see configure)
+    esp_err_t DeviceTable::configure(const config_t& config, bool persist)
+    {
+        size_t pending = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (!config_matches(devices[i], config, persist)) pending++;
+        }
+        if (pending == 0) return ESP_OK;
+
+        if (pending == count) {
+            DS18B20_RETURN_ON_ERROR(ds18b20::configure(handle, NULL, 0, &config, persist), TAG, "error while broadcasting configuration");
+            for (size_t i = 0; i < count; i++) {
+                devices[i].config = normalize(devices[i], config);
+                devices[i].config_valid = true;
+                devices[i].config_saved = persist;
+            }
+            return ESP_OK;
+        }
+
+        esp_err_t ret = ESP_OK;
+        for (size_t i = 0; i < count; i++) {
+            device_t& d = devices[i];
+            if (config_matches(d, config, persist)) continue;
+            esp_err_t err = ds18b20::configure(handle, &d.address, 1, &config, persist);
+            if (err == ESP_OK) {
+                d.config = normalize(d, config);
+                d.config_valid = true;
+                d.config_saved = persist;
+            } else if (ret == ESP_OK) {
+                ret = err;
+            }
+        }
+        return ret;
+    }
+
+    /// @brief Set resolution keeping TH/TL
+    /// @param index Device index
+    /// @param resolution Resolution
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if index is out of range, otherwise see read_config and set_config
+    esp_err_t DeviceTable::set_resolution(size_t index, resolution_t resolution)
+    {
+        DS18B20_RETURN_ON_FALSE(index < count, ESP_ERR_INVALID_ARG, TAG, "invalid device index");
+
+        device_t& d = devices[index];
+        if (!d.config_valid) {
+            DS18B20_RETURN_ON_ERROR(read_config(handle, &d.address, &d.config), TAG, "error while reading configuration");
+            d.config_valid = true;
+        }
+        config_t config = d.config;
+        config.resolution = resolution;
+
+        return set_config(index, config);
+    }
+
+    /// @brief Set alarm thresholds keeping resolution
+    /// @param index Device index
+    /// @param th High threshold
+    /// @param tl Low threshold
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if index is out of range, otherwise see read_config and set_config
+    esp_err_t DeviceTable::set_alarm(size_t index, int8_t th, int8_t tl)
+    {
+        DS18B20_RETURN_ON_FALSE(index < count, ESP_ERR_INVALID_ARG, TAG, "invalid device index");
+
+        device_t& d = devices[index];
+        if (!d.config_valid) {
+            DS18B20_RETURN_ON_ERROR(read_config(handle, &d.address, &d.config), TAG, "error while reading configuration");
+            d.config_valid = true;
+        }
+        config_t config = d.config;
+        config.th = th;
+        config.tl = tl;
+
+        return set_config(index, config);
+    }
+
+    /// @brief Serialize the table, header, one record per device and CRC8 of both
+    /// @param buffer Image output buffer
+    /// @param size Buffer size
+    /// @param length Image length output buffer
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if a pointer is NULL, ESP_ERR_INVALID_SIZE if the buffer is too small
+    esp_err_t DeviceTable::save(uint8_t* buffer, size_t size, size_t* length) const
+    {
+        DS18B20_RETURN_ON_FALSE(buffer && length, ESP_ERR_INVALID_ARG, TAG, "invalid image buffer");
+        DS18B20_RETURN_ON_FALSE(size >= DS18B20_TABLE_IMAGE_SIZE(count), ESP_ERR_INVALID_SIZE, TAG, "image buffer too small");
+
+        buffer[0] = DS18B20_TABLE_IMAGE_MAGIC & 0xFF;
+        buffer[1] = DS18B20_TABLE_IMAGE_MAGIC >> 8;
+        buffer[2] = DS18B20_TABLE_IMAGE_VERSION;
+        buffer[3] = DS18B20_TABLE_IMAGE_RECORD;
+        buffer[4] = count & 0xFF;
+        buffer[5] = (count >> 8) & 0xFF;
+        uint8_t* record = &buffer[DS18B20_TABLE_IMAGE_HEADER];
+        for (size_t i = 0; i < count; i++, record += DS18B20_TABLE_IMAGE_RECORD) {
+            const device_t& d = devices[i];
+            bool saved = d.config_valid && d.config_saved;
+            for (size_t b = 0; b < sizeof(onewire_device_address_t); b++) record[b] = (d.address >> (8 * b)) & 0xFF; // ROM byte order
+            record[8] = saved ? static_cast<uint8_t>(d.config.th) : 0;
+            record[9] = saved ? static_cast<uint8_t>(d.config.tl) : 0;
+            record[10] = saved ? d.config.resolution : 0;
+            record[11] = (saved ? DS18B20_TABLE_FLAG_CONFIG : 0) | (d.power_mode << DS18B20_TABLE_POWER_SHIFT);
+            record[12] = static_cast<uint16_t>(d.calibration.offset) & 0xFF;
+            record[13] = static_cast<uint16_t>(d.calibration.offset) >> 8;
+            record[14] = d.calibration.gain & 0xFF;
+            record[15] = d.calibration.gain >> 8;
+        }
+        *record = crc8(buffer, record - buffer);
+        *length = record - buffer + 1;
+
+        return ESP_OK;
+    }
+
+    /// @brief Check whether a resolution byte is one of resolution_t
+    /// @param value Configuration register
+    /// @return True if valid
+    static bool is_resolution(uint8_t value)
+    {
+        return value == RESOLUTION_9B || value == RESOLUTION_10B || value == RESOLUTION_11B || value == RESOLUTION_12B;
+    }
+
+    /// @brief Fill the table from an image and check that the devices are still there
+    /// @param image Image
+    /// @param length Image length
+    /// @param verify Check presence, search for the changes on mismatch
+    /// @param callback Delta callback (can be NULL)
+    /// @param ctx Callback context
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_STATE if the table is not empty, ESP_ERR_INVALID_ARG (not an image),
+    /// ESP_ERR_INVALID_VERSION, ESP_ERR_INVALID_SIZE or ESP_ERR_INVALID_CRC if the image can't be used, otherwise see scan and refresh
+    esp_err_t DeviceTable::restore(const uint8_t* image, size_t length, bool verify, table_delta_callback_t callback, void* ctx)
+    {
+        DS18B20_RETURN_ON_FALSE(image, ESP_ERR_INVALID_ARG, TAG, "invalid image");
+        DS18B20_RETURN_ON_FALSE(count == 0, ESP_ERR_INVALID_STATE, TAG, "device table not empty");
+        DS18B20_RETURN_ON_FALSE(length >= DS18B20_TABLE_IMAGE_SIZE(0), ESP_ERR_INVALID_SIZE, TAG, "image truncated");
+        DS18B20_RETURN_ON_FALSE(image[0] == (DS18B20_TABLE_IMAGE_MAGIC & 0xFF) && image[1] == (DS18B20_TABLE_IMAGE_MAGIC >> 8),
+                            ESP_ERR_INVALID_ARG, TAG, "not a device table image");
+        DS18B20_RETURN_ON_FALSE(image[2] == DS18B20_TABLE_IMAGE_VERSION && image[3] == DS18B20_TABLE_IMAGE_RECORD,
+                            ESP_ERR_INVALID_VERSION, TAG, "device table image version %u", image[2]);
+        size_t n = image[4] | (image[5] << 8);
+        DS18B20_RETURN_ON_FALSE(length == DS18B20_TABLE_IMAGE_SIZE(n), ESP_ERR_INVALID_SIZE, TAG, "image truncated");
+        DS18B20_RETURN_ON_FALSE(crc8(image, length - 1) == image[length - 1], ESP_ERR_INVALID_CRC, TAG, "device table image corrupt");
+        DS18B20_RETURN_ON_FALSE(n <= max_count, ESP_ERR_INVALID_SIZE, TAG, "device table too small for the image");
+
+        const uint8_t* record = &image[DS18B20_TABLE_IMAGE_HEADER];
+        for (size_t i = 0; i < n; i++, record += DS18B20_TABLE_IMAGE_RECORD) {
+            onewire_device_address_t address = 0;
+            for (size_t b = 0; b < sizeof(onewire_device_address_t); b++) address |= static_cast<onewire_device_address_t>(record[b]) << (8 * b);
+            size_t index;
+            if (add(address, &index) != ESP_OK) continue; // duplicate ROMs can't come from save()
+            device_t& d = devices[index];
+            uint8_t power = (record[11] >> DS18B20_TABLE_POWER_SHIFT) & 0x03;
+            d.power_mode = power <= POWER_PARASITE ? static_cast<power_mode_t>(power) : POWER_UNKNOWN;
+            if ((record[11] & DS18B20_TABLE_FLAG_CONFIG) && is_resolution(record[10])) {
+                d.config.th = static_cast<int8_t>(record[8]);
+                d.config.tl = static_cast<int8_t>(record[9]);
+                d.config.resolution = static_cast<resolution_t>(record[10]);
+                d.config_valid = true;
+                d.config_saved = true;
+            }
+            d.calibration.offset = static_cast<int16_t>(record[12] | (record[13] << 8));
+            d.calibration.gain = static_cast<uint16_t>(record[14] | (record[15] << 8));
+            if (callback) callback(d, true, ctx);
+        }
+        DS18B20_LOGI(TAG, "%u device%s restored", static_cast<unsigned>(count), count != 1 ? "s" : "");
+        if (!verify) return ESP_OK;
+
+        // devices that answer are marked as seen in a fresh pass, so that a search pass only adds and removes the differences
+        search_begin(&search, ONEWIRE_CMD_SEARCH_NORMAL);
+        pass++;
+        pass_clean = true;
+        size_t missing = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (check_presence(i) != ESP_OK) missing++;
+        }
+        if (missing == 0) return refresh(false);
+
+        DS18B20_LOGI(TAG, "%u device%s not answering, searching the bus", static_cast<unsigned>(missing), missing != 1 ? "s" : "");
+        esp_err_t ret = ESP_OK;
+        bool pass_done = false;
+        while (!pass_done) {
+            esp_err_t err = search_step(callback, ctx, &pass_done);
+            if (err == ESP_ERR_NO_MEM) {
+                ret = err;
+            } else if (err != ESP_OK) {
+                DS18B20_LOGE(TAG, "search error: %s", esp_err_to_name(err));
+                return err;
+            }
+        }
+        esp_err_t err = refresh(false);
+        return ret == ESP_OK ? err : ret;
+    }
+
+    esp_err_t DeviceTable::set_calibration(size_t index, const calibration_t& calibration)
+    {
+        DS18B20_RETURN_ON_FALSE(index < count, ESP_ERR_INVALID_ARG, TAG, "invalid device index");
+
+        devices[index].calibration = calibration;
+
+        return ESP_OK;
+    }
+
+    /// @brief Write the calibration offset to TH/TL keeping resolution
+    /// @param index Device index
+    /// @param persist Copy to EEPROM
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if index is out of range, ESP_ERR_INVALID_SIZE if the offset doesn't fit,
+    /// otherwise see read_config and configure
+    esp_err_t DeviceTable::store_offset(size_t index, bool persist)
+    {
+        DS18B20_RETURN_ON_FALSE(index < count, ESP_ERR_INVALID_ARG, TAG, "invalid device index");
+
+        device_t& d = devices[index];
+        int16_t offset = d.calibration.offset;
+        DS18B20_RETURN_ON_FALSE(offset >= -DS18B20_OFFSET_MAX && offset <= DS18B20_OFFSET_MAX, ESP_ERR_INVALID_SIZE, TAG,
+                            "calibration offset %d doesn't fit the user bytes", offset);
+        if (!d.config_valid) {
+            DS18B20_RETURN_ON_ERROR(read_config(handle, &d.address, &d.config), TAG, "error while reading configuration");
+            d.config_valid = true;
+        }
+        config_t config = d.config;
+        config.th = DS18B20_OFFSET_MARKER;
+        config.tl = static_cast<int8_t>(DS18B20_OFFSET_BIAS + offset);
+        if (config_matches(d, config, persist)) return ESP_OK;
+        DS18B20_RETURN_ON_ERROR(ds18b20::configure(handle, &d.address, 1, &config, persist), TAG, "error while storing calibration offset");
+        d.config = config;
+        d.config_saved = persist;
+
+        return ESP_OK;
+    }
+
+    /// @brief Take calibration offsets from the user bytes of the devices that keep one
+    /// @return ESP_OK if succeeded, otherwise first per-device error (see read_config)
+    esp_err_t DeviceTable::load_offsets()
+    {
+        esp_err_t ret = ESP_OK;
+        for (size_t i = 0; i < count; i++) {
+            device_t& d = devices[i];
+            esp_err_t err = refresh_device(i, false);
+            if (err != ESP_OK) {
+                if (ret == ESP_OK) ret = err;
+                continue;
+            }
+            int offset = d.config.tl - DS18B20_OFFSET_BIAS;
+            if (d.config.th != DS18B20_OFFSET_MARKER || offset < -DS18B20_OFFSET_MAX || offset > DS18B20_OFFSET_MAX) continue;
+            d.calibration.offset = static_cast<int16_t>(offset);
+        }
+        return ret;
+    }
+
+    void DeviceTable::record_reading(size_t index, esp_err_t status, int16_t raw)
+    {
+        if (index >= count) return;
+        device_t& d = devices[index];
+        d.last_status = status;
+        d.read_count++;
+        if (status == ESP_OK) {
+            d.last_raw = raw;
+            d.last_seen_us = esp_timer_get_time();
+        } else {
+            d.error_count++;
+        }
+        if (!aggregates || status != ESP_OK) return;
+
+        raw = calibrate(raw, d.calibration);
+        aggregate_t& a = aggregates[index];
+        if (a.count == 0 || raw < a.min) a.min = raw;
+        if (a.count == 0 || raw > a.max) a.max = raw;
+        a.sum += raw;
+        a.count++;
+        int32_t fixed = static_cast<int32_t>(raw) * (1 << DS18B20_EWMA_FRACTION_BITS);
+        if (!a.ewma_valid) {
+            a.ewma = fixed;
+            a.ewma_valid = true;
+        } else {
+            // rounded, the fraction is at least as wide as the shift: converges to the input from above and below alike
+            int64_t step = static_cast<int64_t>(fixed) - a.ewma;
+            if (ewma_shift) step = (step + (INT64_C(1) << (ewma_shift - 1))) >> ewma_shift;
+            a.ewma += static_cast<int32_t>(step);
+        }
+    }
+
+    void DeviceTable::set_aggregates(aggregate_t* storage, uint8_t ewma_shift)
+    {
+        aggregates = storage;
+        this->ewma_shift = ewma_shift < DS18B20_EWMA_FRACTION_BITS ? ewma_shift : DS18B20_EWMA_FRACTION_BITS;
+        if (!aggregates) return;
+        for (size_t i = 0; i < max_count; i++) aggregates[i] = {};
+    }
+
+    /// @brief Divide rounding half away from zero
+    /// @param num Numerator
+    /// @param den Denominator, positive
+    /// @return Quotient
+    static int16_t div_round(int64_t num, int64_t den)
+    {
+        return static_cast<int16_t>((num + (num < 0 ? -den / 2 : den / 2)) / den);
+    }
+
+    /// @brief Take a snapshot of the aggregates of a device
+    /// @param index Index of the device
+    /// @param snapshot Snapshot output buffer
+    /// @param reset Start a new window
+    /// @return ESP_OK if succeeded, ESP_ERR_INVALID_ARG if index or pointer is invalid, ESP_ERR_INVALID_STATE if aggregation is disabled
+    esp_err_t DeviceTable::snapshot(size_t index, aggregate_snapshot_t* snapshot, bool reset)
+    {
+        DS18B20_RETURN_ON_FALSE(index < count && snapshot, ESP_ERR_INVALID_ARG, TAG, "invalid snapshot arguments");
+        DS18B20_RETURN_ON_FALSE(aggregates, ESP_ERR_INVALID_STATE, TAG, "aggregation not enabled");
+
+        aggregate_t& a = aggregates[index];
+        snapshot->count = a.count;
+        snapshot->min_raw = a.count ? a.min : 0;
+        snapshot->max_raw = a.count ? a.max : 0;
+        snapshot->mean_raw = a.count ? div_round(a.sum, a.count) : 0;
+        snapshot->ewma_valid = a.ewma_valid;
+        snapshot->ewma_raw = a.ewma_valid ? div_round(a.ewma, 1 << DS18B20_EWMA_FRACTION_BITS) : 0;
+        if (reset) {
+            a.sum = 0;
+            a.count = 0;
+        }
+
+        return ESP_OK;
+    }
+
+    uint32_t DeviceTable::conversion_time_us(size_t index) const
+    {
+        return get_conversion_time_us(devices[index].config.resolution, get_family(devices[index].address));
+    }
+
+    bool DeviceTable::any_parasite() const
+    {
+        for (size_t i = 0; i < count; i++) {
+            if (devices[i].power_mode != POWER_EXTERNAL) return true;
+        }
+        return false;
+    }
+
+    uint32_t DeviceTable::max_conversion_time_us() const
+    {
+        uint32_t t = 0;
+        for (size_t i = 0; i < count; i++) {
+            uint32_t d = conversion_time_us(i);
+            if (d > t) t = d;
+        }
+        return t;
+    }
+} // namespace ds18b20
@@ -0,0 +1,381 @@
+/**
+ * @file ds18b20_registry.h
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Per-bus DS18B20 device table with cached device state.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "ds18b20.h"
+#include "ds18b20_private.h"
+
+#include <stddef.h>
+
+namespace ds18b20
+{
+    typedef struct {
+        onewire_device_address_t address; /*!< ROM number */
+        config_t config; /*!< cached resolution and TH/TL, valid if config_valid is set */
+        bool config_valid; /*!< config has been read from or written to the device */
+        bool config_saved; /*!< config is known to be copied to the device's EEPROM */
+        power_mode_t power_mode; /*!< cached power supply mode */
+        int16_t last_raw; /*!< last successful reading, 1/16 degrees C */
+        esp_err_t last_status; /*!< result of the last read attempt */
+        uint32_t read_count; /*!< read attempts since the device was added */
+        uint32_t error_count; /*!< failed read attempts since the device was added, error rate is error_count / read_count */
+        int64_t last_seen_us; /*!< esp_timer time of the last successful bus transaction with the device, 0 if never */
+        uint32_t search_pass; /*!< number of the last search pass that found the device */
+        uint8_t missed_passes; /*!< consecutive incomplete search passes without the device, see DS18B20_TABLE_MISSED_PASSES */
+        uint32_t read_cycle; /*!< poller cycle of the last successful read */
+        uint32_t convert_cycle; /*!< poller cycle of the last conversion addressed to the device, UINT32_MAX if none */
+        int64_t convert_us; /*!< esp_timer time of that conversion */
+        uint16_t stable_count; /*!< consecutive readings without significant change, see adaptive_policy_t */
+        uint16_t fail_streak; /*!< consecutive failed reads, see retry_policy_t */
+        uint16_t flap_count; /*!< good to failed transitions since flap_cycle */
+        uint32_t flap_cycle; /*!< poller cycle the flap window started */
+        uint32_t hold_until; /*!< poller cycle the device is read again after a backoff or quarantine */
+        bool quarantined; /*!< failing intermittently, held until quarantine ends and a read succeeds */
+        calibration_t calibration; /*!< applied to published readings and aggregates, last_raw stays in sensor units */
+    } device_t;
+
+#define DS18B20_TABLE_MISSED_PASSES 3 /*!< incomplete search passes in a row (e.g. a reset without presence pulse) that remove a device */
+#define DS18B20_TABLE_IMAGE_VERSION 2 /*!< format of DeviceTable::save() images, bumped on every layout change */
+#define DS18B20_TABLE_IMAGE_SIZE(devices) (7 + 16 * (devices)) /*!< bytes of an image of a table with this many devices */
+
+#define DS18B20_OFFSET_MARKER 126 /*!< TH of a device that keeps a calibration offset in TL, see DeviceTable::store_offset() */
+#define DS18B20_OFFSET_MAX 35 /*!< largest offset magnitude the user bytes hold, 1/16 degrees C */
+
+#define DS18B20_EWMA_FRACTION_BITS 16 /*!< fixed point fraction of aggregate_t::ewma, also the largest moving average shift */
+
+    typedef struct {
+        int64_t sum; /*!< sum of the readings in the window, 1/16 degrees C */
+        uint32_t count; /*!< successful readings in the window */
+        int16_t min; /*!< window minimum, 1/16 degrees C */
+        int16_t max; /*!< window maximum, 1/16 degrees C */
+        int32_t ewma; /*!< exponentially weighted moving average, not reset with the window, 1/16 degrees C in fixed point */
+        bool ewma_valid; /*!< ewma has been seeded with a reading */
+    } aggregate_t;
+
+    typedef struct {
+        uint32_t count; /*!< readings in the window, min_raw, max_raw and mean_raw are valid only if nonzero */
+        int16_t min_raw; /*!< window minimum, 1/16 degrees C */
+        int16_t max_raw; /*!< window maximum, 1/16 degrees C */
+        int16_t mean_raw; /*!< window mean, 1/16 degrees C, rounded half away from zero */
+        int16_t ewma_raw; /*!< moving average, 1/16 degrees C, rounded half away from zero, valid if ewma_valid */
+        bool ewma_valid; /*!< at least one reading since aggregation was enabled or the device was added */
+    } aggregate_snapshot_t;
+
+    /**
+     * @brief Device table change callback
+     *
+     * @param[in] device Device that was added or is about to be removed (a copy, the table may already be modified)
+     * @param[in] added True if the device was added, false if removed
+     * @param[in] ctx User context
+     */
+    typedef void (*table_delta_callback_t)(const device_t& device, bool added, void* ctx);
+
+    /**
+     * @brief Table of known devices on one bus, storage is owned by the caller.
+     * Not thread safe: serialize access with the bus transactions that use it.
+     */
+    class DeviceTable
+    {
+    public:
+        /**
+         * @brief Create an empty device table
+         *
+         * @param[in] handle 1-wire handle the devices are on
+         * @param[in] storage Device storage
+         * @param[in] capacity Number of device_t entries in storage
+         */
+        DeviceTable(onewire_bus_handle_t handle, device_t* storage, size_t capacity);
+
+        DeviceTable(const DeviceTable&) = delete;
+        DeviceTable& operator=(const DeviceTable&) = delete;
+
+        /**
+         * @brief Add a device with unknown configuration, does not touch the bus
+         *
+         * @param[in] address ROM number
+         * @param[out] index Index of the device in the table (can be NULL)
+         * @return
+         *         - ESP_OK                Device added or already known.
+         *         - ESP_ERR_NO_MEM        Table is full.
+         */
+        esp_err_t add(onewire_device_address_t address, size_t* index);
+
+        /**
+         * @brief Remove a device, the last device takes its index
+         *
+         * @param[in] index Index of the device
+         */
+        void remove(size_t index);
+
+        /**
+         * @brief Find a device by ROM number
+         *
+         * @param[in] address ROM number
+         * @return Index of the device or -1 if not known
+         */
+        int find(onewire_device_address_t address) const;
+
+        /**
+         * @brief Synchronize the table with the bus: a full search pass, newly found devices are added
+         * and get their configuration read, devices that were not found are removed (see search_step()). Devices of families the
+         * library can't read (see is_supported_family()) are left out, so DS18S20, DS1822 and DS18B20 share a table.
+         *
+         * @param[in] callback Called for every added or removed device, can be NULL
+         * @param[in] ctx Passed to callback
+         * @return
+         *         - ESP_OK                Search finished.
+         *         - ESP_ERR_NO_MEM        Table is full, some devices were not added.
+         *         - Otherwise see search_step().
+         */
+        esp_err_t scan(table_delta_callback_t callback = NULL, void* ctx = NULL);
+
+        /**
+         * @brief Advance the resumable search by one device, so that hot-plug detection can be spread over
+         * sampling cycles. Known devices are only marked as seen. When the search wraps around, devices that
+         * were not seen during the whole pass are removed. A pass that ends with ESP_ERR_NOT_FOUND from
+         * ds18b20::search_next() (an empty bus, but also a reset without presence pulse or a search nobody answers
+         * halfway) is incomplete: devices it missed are removed only after DS18B20_TABLE_MISSED_PASSES such passes in a row.
+         *
+         * @param[in] callback Called for every added or removed device, can be NULL
+         * @param[in] ctx Passed to callback
+         * @param[out] pass_done Set if this step completed a search pass (can be NULL)
+         * @return
+         *         - ESP_OK                Step done.
+         *         - ESP_ERR_NO_MEM        A new device was found, but the table is full.
+         *         - Otherwise see ds18b20::search_next(), the pass is restarted and nothing is removed.
+         */
+        esp_err_t search_step(table_delta_callback_t callback, void* ctx, bool* pass_done);
+
+        /**
+         * @brief Check that a known device is still present: a MATCH ROM scratchpad read, which costs less than half of
+         * the search pass of ds18b20::verify(). The device is marked as seen in the current search pass and its cached
+         * configuration is updated from the read (a device that lost it is no longer config_saved).
+         *
+         * @param[in] index Index of the device
+         * @return
+         *         - ESP_OK                Device is present.
+         *         - ESP_ERR_NOT_FOUND     No device on the bus answered the reset.
+         *         - ESP_ERR_INVALID_CRC   Device didn't answer (an absent device reads as all ones) or the read was corrupt.
+         *         - Otherwise see ds18b20::read_config().
+         */
+        esp_err_t check_presence(size_t index);
+
+        /**
+         * @brief Read configuration and power supply mode of every device that doesn't have them cached yet
+         *
+         * @param[in] force Re-read configuration and power supply mode of all devices
+         * @return
+         *         - ESP_OK                Configuration of every device is cached.
+         *         - Otherwise             First per-device error, see ds18b20::read_config() and ds18b20::read_power_supply().
+         */
+        esp_err_t refresh(bool force);
+
+        /**
+         * @brief Write configuration of a device and update the cache, skipped if cached configuration already matches
+         *
+         * @param[in] index Index of the device
+         * @param[in] config Configuration
+         * @return See ds18b20::set_config()
+         */
+        esp_err_t set_config(size_t index, const config_t& config);
+
+        /**
+         * @brief Write the same configuration to every device that doesn't have it cached already.
+         * If every device needs it, a single broadcast write is used (devices not in the table are configured too).
+         *
+         * @param[in] config Configuration
+         * @param[in] persist Also copy configuration to EEPROM, devices with already saved matching configuration are skipped
+         * @return See ds18b20::configure()
+         */
+        esp_err_t configure(const config_t& config, bool persist);
+
+        /**
+         * @brief Set resolution of a device keeping cached TH/TL, skipped if cached resolution already matches
+         *
+         * @param[in] index Index of the device
+         * @param[in] resolution Resolution
+         * @return See ds18b20::set_config(), ds18b20::read_config() if configuration is not cached
+         */
+        esp_err_t set_resolution(size_t index, resolution_t resolution);
+
+        /**
+         * @brief Set alarm thresholds of a device keeping cached resolution, skipped if cached thresholds already match
+         *
+         * @param[in] index Index of the device
+         * @param[in] th High threshold, degrees C
+         * @param[in] tl Low threshold, degrees C
+         * @return See ds18b20::set_config(), ds18b20::read_config() if configuration is not cached
+         */
+        esp_err_t set_alarm(size_t index, int8_t th, int8_t tl);
+
+        /**
+         * @brief Serialize the devices, their calibration and cached configuration and power mode to a compact image,
+         * to be stored (e.g. in NVS, see save_table()) and restored on the next boot instead of a scan().
+         * Configuration is only kept for devices that have it in EEPROM, the scratchpad of the rest may be
+         * reloaded by a power cycle. Readings, statistics and health state are not saved.
+         *
+         * @param[out] buffer Image buffer
+         * @param[in] size Buffer size, at least DS18B20_TABLE_IMAGE_SIZE(size())
+         * @param[out] length Image length
+         * @return
+         *         - ESP_OK                Image written.
+         *         - ESP_ERR_INVALID_ARG   Invalid argument.
+         *         - ESP_ERR_INVALID_SIZE  Buffer too small.
+         */
+        esp_err_t save(uint8_t* buffer, size_t size, size_t* length) const;
+
+        /**
+         * @brief Fill an empty table from an image made by save(). With verify, every device is checked with
+         * check_presence(), one addressed scratchpad read per device that also refreshes its cached configuration. If a device
+         * doesn't answer, one search pass of search_step() adds and removes only the differences: the devices that answered
+         * keep their restored state, new ones get their configuration read. Devices added since the image was made
+         * are otherwise found by search_step().
+         *
+         * @param[in] image Image
+         * @param[in] length Image length
+         * @param[in] verify Check presence of the devices
+         * @param[in] callback Called for every restored device (as added) and for every delta of the fallback scan, can be NULL
+         * @param[in] ctx Passed to callback
+         * @return
+         *         - ESP_OK                Table restored (and verified, or searched for changes).
+         *         - ESP_ERR_INVALID_STATE Table is not empty.
+         *         - ESP_ERR_INVALID_ARG   Invalid argument, or the data is not a device table image (wrong magic).
+         *         - ESP_ERR_INVALID_SIZE  Image is truncated or doesn't fit the table capacity.
+         *         - ESP_ERR_INVALID_CRC   Image is corrupt.
+         *         - ESP_ERR_INVALID_VERSION Image was made by another version of the format, nothing is restored.
+         *         - Otherwise see search_step() and refresh().
+         */
+        esp_err_t restore(const uint8_t* image, size_t length, bool verify = true, table_delta_callback_t callback = NULL,
+            void* ctx = NULL);
+
+        /**
+         * @brief Set the calibration of a device, does not touch the bus
+         *
+         * @param[in] index Index of the device
+         * @param[in] calibration Calibration, see calibrate()
+         * @return
+         *         - ESP_OK                Set.
+         *         - ESP_ERR_INVALID_ARG   Invalid index.
+         */
+        esp_err_t set_calibration(size_t index, const calibration_t& calibration);
+
+        /**
+         * @brief Keep the calibration offset of a device in its TH/TL user bytes, so that it travels with the sensor.
+         * TH is set to DS18B20_OFFSET_MARKER and TL to a biased offset, both out of the measurement range, so the
+         * device never alarms: a device can keep either an offset or alarm thresholds. Resolution is kept.
+         *
+         * @param[in] index Index of the device
+         * @param[in] persist Also copy to EEPROM
+         * @return
+         *         - ESP_OK                Stored.
+         *         - ESP_ERR_INVALID_ARG   Invalid index.
+         *         - ESP_ERR_INVALID_SIZE  Offset magnitude is over DS18B20_OFFSET_MAX.
+         *         - Otherwise see ds18b20::read_config() if configuration is not cached, ds18b20::configure().
+         */
+        esp_err_t store_offset(size_t index, bool persist);
+
+        /**
+         * @brief Set the calibration offset of every device that keeps one in its user bytes (see store_offset()),
+         * gains are kept. Configuration is read from devices that don't have it cached.
+         *
+         * @return
+         *         - ESP_OK                Done, devices without an offset are left as they are.
+         *         - Otherwise             First per-device error, see ds18b20::read_config().
+         */
+        esp_err_t load_offsets();
+
+        /**
+         * @brief Record result of a read attempt in the cache
+         *
+         * @param[in] index Index of the device
+         * @param[in] status Read result
+         * @param[in] raw Reading (1/16 degrees C, uncalibrated), used only if status is ESP_OK
+         */
+        void record_reading(size_t index, esp_err_t status, int16_t raw);
+
+        /**
+         * @brief Enable streaming aggregation of successful calibrated readings: windowed min, max and mean and a moving average,
+         * integer math in sensor units, constant memory per device
+         *
+         * @param[in] storage Aggregator storage (capacity() entries), owned by the caller, NULL to disable
+         * @param[in] ewma_shift Moving average weight of a new reading is 1 / 2^ewma_shift, 0 to follow the last reading,
+         * at most DS18B20_EWMA_FRACTION_BITS
+         */
+        void set_aggregates(aggregate_t* storage, uint8_t ewma_shift);
+
+        /**
+         * @brief Get the aggregates of a device, constant time
+         *
+         * @param[in] index Index of the device
+         * @param[out] snapshot Aggregates
+         * @param[in] reset Start a new window (the moving average goes on)
+         * @return
+         *         - ESP_OK                Snapshot taken.
+         *         - ESP_ERR_INVALID_ARG   Invalid index or pointer.
+         *         - ESP_ERR_INVALID_STATE Aggregation is not enabled.
+         */
+        esp_err_t snapshot(size_t index, aggregate_snapshot_t* snapshot, bool reset);
+
+        /**
+         * @brief Get conversion time of a device from the cached resolution (12-bit if not known)
+         *
+         * @param[in] index Index of the device
+         * @return Conversion time, us
+         */
+        uint32_t conversion_time_us(size_t index) const;
+
+        /**
+         * @brief Check whether any device may be parasite-powered (devices with unknown power mode are counted)
+         *
+         * @return True if a broadcast conversion needs a strong pull-up
+         */
+        bool any_parasite() const;
+
+        /**
+         * @brief Get conversion time of the slowest device
+         *
+         * @return Conversion time, us
+         */
+        uint32_t max_conversion_time_us() const;
+
+        onewire_bus_handle_t bus() const { return handle; }
+        size_t size() const { return count; }
+        size_t capacity() const { return max_count; }
+        device_t& operator[](size_t index) { return devices[index]; }
+        const device_t& operator[](size_t index) const { return devices[index]; }
+
+    private:
+        onewire_bus_handle_t handle;
+        device_t* devices;
+        size_t max_count;
+        size_t count;
+        search_context_t search;
+        uint32_t pass;
+        bool pass_clean;
+        aggregate_t* aggregates;
+        uint8_t ewma_shift;
+
+        esp_err_t refresh_device(size_t index, bool force);
+        void finish_pass(table_delta_callback_t callback, void* ctx);
+    };
+} // namespace ds18b20
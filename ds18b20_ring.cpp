@@ -0,0 +1,104 @@
+/**
+ * @file ds18b20_ring.cpp
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Lock-free single-producer multi-consumer sample ring.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ds18b20_ring.h"
+
+#include <string.h>
+
+namespace ds18b20
+{
+    // Slots are copied word by word with relaxed atomics, so that a reader racing the producer sees stale or new words,
+    // never a data race. Ordering comes from the fences around the copies.
+    typedef uint32_t __attribute__((__may_alias__)) sample_word_t;
+    static constexpr size_t sample_words = sizeof(sample_t) / sizeof(sample_word_t);
+    static_assert(sizeof(sample_t) % sizeof(sample_word_t) == 0, "sample_t must be a whole number of words");
+
+    SampleRing::SampleRing(sample_t* storage, size_t capacity)
+        : buffer(NULL), mask(0), head(0), claimed(0)
+    {
+        // power of 2 keeps index wrap-around a mask, and fits well below 2^31 for unsigned distance math
+        if (storage && capacity && (capacity & (capacity - 1)) == 0 && capacity <= (1u << 30)) {
+            buffer = storage;
+            mask = capacity - 1;
+        }
+    }
+
+    void SampleRing::push(const sample_t& sample)
+    {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        claimed.store(h + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release); // readers that see the new data also see the claim
+        sample_word_t words[sample_words];
+        memcpy(words, &sample, sizeof(sample));
+        sample_word_t* slot = reinterpret_cast<sample_word_t*>(&buffer[h & mask]);
+        for (size_t i = 0; i < sample_words; i++) __atomic_store_n(&slot[i], words[i], __ATOMIC_RELAXED);
+        head.store(h + 1, std::memory_order_release); // publish the slot
+    }
+
+    SampleRing::Reader::Reader(const SampleRing& ring)
+        : ring(ring), tail(ring.head.load(std::memory_order_acquire)), dropped(0)
+    {
+    }
+
+    size_t SampleRing::Reader::peek(const sample_t** samples)
+    {
+        uint32_t h = ring.head.load(std::memory_order_acquire); // pairs with the release in push(), published words are visible
+        uint32_t available = h - tail;
+        uint32_t capacity = ring.mask + 1;
+        if (available > capacity) { // lapped, skip to the oldest sample still in the ring
+            dropped += available - capacity;
+            tail = h - capacity;
+            available = capacity;
+        }
+        uint32_t start = tail & ring.mask;
+        uint32_t contiguous = capacity - start;
+        *samples = &ring.buffer[start];
+        return available < contiguous ? available : contiguous;
+    }
+
+    void SampleRing::Reader::load(const sample_t& slot, sample_t* sample)
+    {
+        const sample_word_t* words = reinterpret_cast<const sample_word_t*>(&slot);
+        sample_word_t copy[sample_words];
+        for (size_t i = 0; i < sample_words; i++) copy[i] = __atomic_load_n(&words[i], __ATOMIC_RELAXED);
+        memcpy(sample, copy, sizeof(copy));
+    }
+
+    esp_err_t SampleRing::Reader::commit(size_t n)
+    {
+        // the caller's reads of the span must not be reordered after the claim check (seqlock-style validation)
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint32_t h = ring.claimed.load(std::memory_order_relaxed);
+        uint32_t capacity = ring.mask + 1;
+        // slot of sample i is rewritten once sample i + capacity is claimed
+        bool intact = h - tail <= capacity;
+        tail += n;
+        if (intact) return ESP_OK;
+
+        dropped += n; // the caller discards them
+        if (h - tail > capacity) {
+            dropped += h - tail - capacity;
+            tail = h - capacity;
+        }
+        return ESP_ERR_INVALID_STATE;
+    }
+} // namespace ds18b20
@@ -0,0 +1,127 @@
+/**
+ * @file ds18b20_ring.h
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Lock-free single-producer multi-consumer sample ring.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ds18b20
+{
+    typedef struct {
+        int64_t timestamp_us; /*!< esp_timer time of the read completion */
+        int64_t convert_us; /*!< esp_timer time of the Convert T command, sample age is timestamp_us - convert_us */
+        uint32_t sequence; /*!< sampling cycle number, to align samples of several buses */
+        uint16_t index; /*!< index of the device in its device table */
+        int16_t raw; /*!< calibrated temperature, 1/16 degrees C, valid only if status is ESP_OK */
+        int16_t status; /*!< esp_err_t of the read (all library error codes fit 16 bits) */
+    } sample_t;
+
+    /**
+     * @brief Fixed-size ring of samples with one producer (the sampling task) and any number of consumers.
+     * The producer never waits: when the ring is full, the oldest samples are overwritten. Every consumer
+     * has its own Reader and reads samples in place at its own pace; a Reader that falls behind loses the
+     * overwritten samples and is told so. Storage is owned by the caller.
+     */
+    class SampleRing
+    {
+    public:
+        /**
+         * @brief Create an empty ring
+         *
+         * @param[in] storage Sample storage
+         * @param[in] capacity Number of samples in storage, must be a power of 2
+         */
+        SampleRing(sample_t* storage, size_t capacity);
+
+        /**
+         * @brief Append a sample, overwriting the oldest one if the ring is full. Producer only.
+         *
+         * @param[in] sample Sample
+         */
+        void push(const sample_t& sample);
+
+        bool is_valid() const { return buffer != NULL; }
+        size_t capacity() const { return mask + 1; }
+
+        class Reader
+        {
+        public:
+            /**
+             * @brief Create a reader that starts with the next sample pushed
+             *
+             * @param[in] ring Ring to read from
+             */
+            explicit Reader(const SampleRing& ring);
+
+            /**
+             * @brief Get the longest contiguous span of unread samples, without copying. The producer may be rewriting
+             * a slot while it is read: load() copies one out with relaxed atomic word loads, which is race-free. Reading
+             * the fields in place relies on aligned word loads not tearing (GCC on Xtensa and RISC-V). Either way
+             * commit() tells if the data was overwritten meanwhile.
+             *
+             * @param[out] samples First unread sample, valid until commit()
+             * @return Number of samples in the span, 0 if there are no new samples
+             */
+            size_t peek(const sample_t** samples);
+
+            /**
+             * @brief Copy a sample out of a peek() span with relaxed atomic word loads
+             *
+             * @param[in] slot Sample in the span
+             * @param[out] sample Copy, valid if the following commit() succeeds
+             */
+            static void load(const sample_t& slot, sample_t* sample);
+
+            /**
+             * @brief Mark samples returned by peek() as read and check that the producer didn't overwrite them meanwhile
+             *
+             * @param[in] n Number of samples consumed, up to the peek() result
+             * @return
+             *         - ESP_OK                Samples were intact while they were read.
+             *         - ESP_ERR_INVALID_STATE The producer overwrote some of them, discard the data, lost() is updated.
+             */
+            esp_err_t commit(size_t n);
+
+            /**
+             * @brief Number of samples overwritten before this reader got to them
+             *
+             * @return Sample count
+             */
+            uint32_t lost() const { return dropped; }
+
+        private:
+            const SampleRing& ring;
+            uint32_t tail;
+            uint32_t dropped;
+        };
+
+    private:
+        sample_t* buffer;
+        uint32_t mask;
+        std::atomic<uint32_t> head; /*!< samples published */
+        std::atomic<uint32_t> claimed; /*!< samples being or already written, runs ahead of head during push() */
+    };
+} // namespace ds18b20
@@ -0,0 +1,419 @@
+/**
+ * @file ds18b20_sim.cpp
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Simulated 1-Wire bus with virtual DS18B20 devices.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ds18b20_sim.h"
+
+#if defined(ESP_PLATFORM)
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#endif
+
+#include <string.h>
+#include <type_traits>
+
+// standard speed slot lengths (Maxim application note 126): reset pulse, presence detect and recovery; time slot and recovery
+#define SIM_RESET_TIME_US 960
+#define SIM_SLOT_TIME_US 70
+
+#define SIM_EEPROM_WRITE_TIME_US 10000
+
+#define SIM_CMD_MATCH_ROM 0x55
+#define SIM_CMD_SKIP_ROM 0xCC
+#define SIM_CMD_READ_ROM 0x33
+#define SIM_CMD_SEARCH_ROM 0xF0
+#define SIM_CMD_ALARM_SEARCH 0xEC
+#define SIM_CMD_CONVERT_TEMP 0x44
+#define SIM_CMD_WRITE_SCRATCHPAD 0x4E
+#define SIM_CMD_READ_SCRATCHPAD 0xBE
+#define SIM_CMD_COPY_SCRATCHPAD 0x48
+#define SIM_CMD_RECALL_EEPROM 0xB8
+#define SIM_CMD_READ_POWER_SUPPLY 0xB4
+
+namespace ds18b20
+{
+    static_assert(std::is_standard_layout<SimBus>::value, "handle is cast back to SimBus");
+
+    namespace sim_clock
+    {
+#if defined(ESP_PLATFORM)
+        int64_t now_us()
+        {
+            return esp_timer_get_time();
+        }
+
+        void delay_us(uint32_t us)
+        {
+            esp_rom_delay_us(us);
+        }
+#else
+        static int64_t virtual_us; // host build: time passes only when someone waits
+
+        int64_t now_us()
+        {
+            return virtual_us;
+        }
+
+        void delay_us(uint32_t us)
+        {
+            virtual_us += us;
+        }
+#endif
+    } // namespace sim_clock
+
+    /// @brief Check whether a device is a DS18S20: 0.5 degrees C register with COUNT REMAIN, no configuration register
+    /// @param d Device
+    /// @return True for family 0x10
+    static bool is_s20(const sim_device_t& d)
+    {
+        return get_family(d.address) == FAMILY_DS18S20;
+    }
+
+    SimBus::SimBus(sim_device_t* devices, size_t count, const sim_config_t& config)
+        : devices(devices), count(devices ? count : 0), config(config), phase(PHASE_IDLE), bit(0), shift(0),
+          time_us(0), corrupted(0), noise(config.seed ? config.seed : 1)
+    {
+        base.reset = reset;
+        base.write_bytes = write_bytes;
+        base.read_bytes = read_bytes;
+        base.write_bit = write_bit;
+        base.read_bit = read_bit;
+        base.del = del;
+        for (size_t i = 0; i < this->count; i++) power_on(i);
+    }
+
+    void SimBus::power_on(size_t index)
+    {
+        if (index >= count) return;
+        sim_device_t& d = devices[index];
+        const uint8_t scratchpad[9] = {
+            0x50, 0x05, // 85 degrees C
+            static_cast<uint8_t>(d.th), static_cast<uint8_t>(d.tl), static_cast<uint8_t>(d.resolution),
+            0xFF, 0x0C, 0x10, 0x00
+        };
+        memcpy(d.state.scratchpad, scratchpad, sizeof(scratchpad));
+        if (is_s20(d)) { // 85 degrees C in 0.5 degrees C units, no configuration register
+            d.state.scratchpad[0] = 0xAA;
+            d.state.scratchpad[1] = 0x00;
+            d.state.scratchpad[4] = 0xFF;
+        }
+        d.state.busy_until_us = 0;
+        d.state.converting = false;
+        d.state.active = false;
+        d.state.output_size = 0;
+    }
+
+    onewire_device_address_t SimBus::make_address(uint64_t serial, uint8_t family)
+    {
+        uint8_t rom[8];
+        rom[0] = family;
+        for (int i = 1; i < 7; i++) rom[i] = (serial >> (8 * (i - 1))) & 0xFF;
+        rom[7] = crc8(rom, 7);
+        onewire_device_address_t address = 0;
+        for (int i = 7; i >= 0; i--) address = (address << 8) | rom[i];
+        return address;
+    }
+
+    /// @brief Account for modeled bus time
+    /// @param us Duration of the bus operation
+    void SimBus::elapse(uint32_t us)
+    {
+        time_us += us;
+        if (config.realtime) sim_clock::delay_us(us);
+    }
+
+    /// @brief Finish a conversion of a device if it's due: temperature registers get the measured value
+    /// with the bits undefined at the configured resolution cleared
+    /// @param d Device
+    /// @param now sim_clock time
+    void SimBus::update(sim_device_t& d, int64_t now)
+    {
+        if (!d.state.converting || now < d.state.busy_until_us) return;
+        d.state.converting = false;
+        if (is_s20(d)) {
+            // TEMP_READ rounded to 0.5 degrees C, COUNT_REMAIN in 1/16 so that the extended result is the measured value
+            int16_t whole = static_cast<int16_t>(d.temperature + 4) >> 4; // reads back as whole - 0.25 + (16 - COUNT_REMAIN) / 16
+            uint16_t half = static_cast<uint16_t>(static_cast<int16_t>(d.temperature + 4) >> 3);
+            d.state.scratchpad[0] = half & 0xFF;
+            d.state.scratchpad[1] = half >> 8;
+            d.state.scratchpad[6] = static_cast<uint8_t>(whole * 16 + 12 - d.temperature);
+            return;
+        }
+        uint8_t undefined_bits = 3 - ((d.state.scratchpad[4] >> 5) & 0x03);
+        uint16_t raw = static_cast<uint16_t>(d.temperature) & ~((1u << undefined_bits) - 1);
+        d.state.scratchpad[0] = raw & 0xFF;
+        d.state.scratchpad[1] = raw >> 8;
+        d.state.scratchpad[6] = 0x10 - (raw & 0x0F);
+    }
+
+    /// @brief Check the alarm condition of a device: integer part of the last conversion result is at or beyond TH or TL
+    /// @param d Device
+    /// @return True if alarmed
+    bool SimBus::alarmed(const sim_device_t& d) const
+    {
+        int16_t t = static_cast<int16_t>(d.state.scratchpad[0] | (d.state.scratchpad[1] << 8)) >> (is_s20(d) ? 1 : 4);
+        return t >= static_cast<int8_t>(d.state.scratchpad[2]) || t <= static_cast<int8_t>(d.state.scratchpad[3]);
+    }
+
+    /// @brief Get the level a device drives during a read slot
+    /// @param d Device
+    /// @param now sim_clock time
+    /// @return 0 if the device pulls the line low, 1 if it leaves it released
+    uint8_t SimBus::drive(sim_device_t& d, int64_t now) const
+    {
+        switch (phase) {
+        case PHASE_SEARCH_ROM: {
+            uint8_t rom_bit = (d.address >> (bit / 3)) & 0x01;
+            switch (bit % 3) {
+            case 0: return rom_bit;
+            case 1: return !rom_bit;
+            default: return 1; // direction is written by the master
+            }
+        }
+        case PHASE_OUTPUT:
+            if (bit / 8 >= d.state.output_size) return 1;
+            return (d.state.output[bit / 8] >> (bit % 8)) & 0x01;
+        case PHASE_POWER_SUPPLY:
+            return d.parasite ? 0 : 1;
+        case PHASE_BUSY:
+            return now < d.state.busy_until_us ? 0 : 1;
+        default:
+            return 1;
+        }
+    }
+
+    /// @brief Run one time slot: wired-AND of the master and every selected device, then devices sample the line
+    /// @param master Bit written by the master, 1 for a read slot
+    /// @return Level seen by the master
+    uint8_t SimBus::slot(uint8_t master)
+    {
+        int64_t now = sim_clock::now_us();
+        elapse(SIM_SLOT_TIME_US);
+
+        uint8_t line = master & 0x01;
+        if (line) { // a written 0 is already low
+            for (size_t i = 0; i < count; i++) {
+                if (devices[i].present && devices[i].state.active) line &= drive(devices[i], now);
+            }
+        }
+
+        uint8_t seen = line;
+        if (master && config.bit_error_ppm) {
+            noise ^= noise << 13; // xorshift32
+            noise ^= noise >> 17;
+            noise ^= noise << 5;
+            if (noise % 1000000 < config.bit_error_ppm) {
+                seen ^= 0x01;
+                corrupted++;
+            }
+        }
+
+        sample(line, now);
+        return seen;
+    }
+
+    /// @brief Let the selected devices process the level of the last slot
+    /// @param line Line level
+    /// @param now sim_clock time
+    void SimBus::sample(uint8_t line, int64_t now)
+    {
+        switch (phase) {
+        case PHASE_ROM_COMMAND:
+        case PHASE_FUNCTION_COMMAND:
+            shift |= line << bit;
+            if (++bit == 8) command(shift, now);
+            break;
+        case PHASE_MATCH_ROM:
+            for (size_t i = 0; i < count; i++) {
+                if (((devices[i].address >> bit) & 0x01) != line) devices[i].state.active = false;
+            }
+            if (++bit == 64) {
+                phase = PHASE_FUNCTION_COMMAND;
+                bit = 0;
+                shift = 0;
+            }
+            break;
+        case PHASE_SEARCH_ROM:
+            if (bit % 3 == 2) {
+                for (size_t i = 0; i < count; i++) {
+                    if (((devices[i].address >> (bit / 3)) & 0x01) != line) devices[i].state.active = false;
+                }
+            }
+            if (++bit == 64 * 3) {
+                phase = PHASE_FUNCTION_COMMAND;
+                bit = 0;
+                shift = 0;
+            }
+            break;
+        case PHASE_WRITE_SCRATCHPAD:
+            shift |= line << (bit % 8);
+            if (bit % 8 == 7) { // devices store every byte as soon as it's received
+                uint8_t value = bit / 8 == 2 ? (shift & 0x60) | 0x1F : shift; // only resolution bits are writable
+                for (size_t i = 0; i < count; i++) {
+                    if (bit / 8 == 2 && is_s20(devices[i])) continue; // DS18S20 takes TH and TL only
+                    if (devices[i].present && devices[i].state.active) devices[i].state.scratchpad[2 + bit / 8] = value;
+                }
+                shift = 0;
+            }
+            if (++bit == 24) phase = PHASE_IDLE;
+            break;
+        case PHASE_OUTPUT:
+            bit++;
+            break;
+        default:
+            break;
+        }
+    }
+
+    /// @brief Execute a ROM or function command on the selected devices
+    /// @param cmd Command
+    /// @param now sim_clock time
+    void SimBus::command(uint8_t cmd, int64_t now)
+    {
+        bool rom_command = phase == PHASE_ROM_COMMAND;
+        bit = 0;
+        shift = 0;
+        phase = PHASE_IDLE;
+
+        for (size_t i = 0; i < count; i++) {
+            sim_device_t& d = devices[i];
+            if (!d.present || !d.state.active) continue;
+            update(d, now);
+            if (rom_command) {
+                switch (cmd) {
+                case SIM_CMD_ALARM_SEARCH:
+                    d.state.active = alarmed(d);
+                    break;
+                case SIM_CMD_READ_ROM:
+                    memcpy(d.state.output, &d.address, 8);
+                    d.state.output_size = 8;
+                    break;
+                default:
+                    break;
+                }
+                continue;
+            }
+            switch (cmd) {
+            case SIM_CMD_CONVERT_TEMP: {
+                uint8_t r = is_s20(d) ? 3 : (d.state.scratchpad[4] >> 5) & 0x03;
+                d.state.converting = true;
+                d.state.busy_until_us = now + static_cast<int64_t>(93750 << r) * config.conversion_scale_pct / 100;
+                break;
+            }
+            case SIM_CMD_READ_SCRATCHPAD:
+                d.state.scratchpad[8] = crc8(d.state.scratchpad, 8);
+                memcpy(d.state.output, d.state.scratchpad, 9);
+                d.state.output_size = 9;
+                break;
+            case SIM_CMD_COPY_SCRATCHPAD:
+                d.th = static_cast<int8_t>(d.state.scratchpad[2]);
+                d.tl = static_cast<int8_t>(d.state.scratchpad[3]);
+                if (!is_s20(d)) d.resolution = static_cast<resolution_t>(d.state.scratchpad[4]);
+                d.state.busy_until_us = now + SIM_EEPROM_WRITE_TIME_US;
+                break;
+            case SIM_CMD_RECALL_EEPROM:
+                d.state.scratchpad[2] = static_cast<uint8_t>(d.th);
+                d.state.scratchpad[3] = static_cast<uint8_t>(d.tl);
+                d.state.scratchpad[4] = static_cast<uint8_t>(d.resolution);
+                break;
+            default:
+                break;
+            }
+        }
+
+        switch (cmd) {
+        case SIM_CMD_MATCH_ROM: if (rom_command) phase = PHASE_MATCH_ROM; break;
+        case SIM_CMD_SKIP_ROM: if (rom_command) phase = PHASE_FUNCTION_COMMAND; break;
+        case SIM_CMD_SEARCH_ROM:
+        case SIM_CMD_ALARM_SEARCH: if (rom_command) phase = PHASE_SEARCH_ROM; break;
+        case SIM_CMD_READ_ROM: if (rom_command) phase = PHASE_OUTPUT; break;
+        case SIM_CMD_CONVERT_TEMP:
+        case SIM_CMD_COPY_SCRATCHPAD:
+        case SIM_CMD_RECALL_EEPROM: if (!rom_command) phase = PHASE_BUSY; break;
+        case SIM_CMD_READ_SCRATCHPAD: if (!rom_command) phase = PHASE_OUTPUT; break;
+        case SIM_CMD_WRITE_SCRATCHPAD: if (!rom_command) phase = PHASE_WRITE_SCRATCHPAD; break;
+        case SIM_CMD_READ_POWER_SUPPLY: if (!rom_command) phase = PHASE_POWER_SUPPLY; break;
+        default: break;
+        }
+    }
+
+    esp_err_t SimBus::reset(onewire_bus_t* bus)
+    {
+        SimBus* sim = from(bus);
+        int64_t now = sim_clock::now_us();
+        sim->elapse(SIM_RESET_TIME_US);
+
+        bool presence = false;
+        for (size_t i = 0; i < sim->count; i++) {
+            sim_device_t& d = sim->devices[i];
+            sim->update(d, now); // a running conversion is not interrupted
+            d.state.active = d.present;
+            d.state.output_size = 0;
+            presence |= d.present;
+        }
+        sim->phase = presence ? PHASE_ROM_COMMAND : PHASE_IDLE;
+        sim->bit = 0;
+        sim->shift = 0;
+
+        return presence ? ESP_OK : ESP_ERR_NOT_FOUND;
+    }
+
+    esp_err_t SimBus::write_bytes(onewire_bus_t* bus, const uint8_t* tx_data, uint8_t tx_data_size)
+    {
+        if (!tx_data) return ESP_ERR_INVALID_ARG;
+        SimBus* sim = from(bus);
+        for (uint8_t i = 0; i < tx_data_size; i++) {
+            for (int b = 0; b < 8; b++) sim->slot((tx_data[i] >> b) & 0x01);
+        }
+        return ESP_OK;
+    }
+
+    esp_err_t SimBus::read_bytes(onewire_bus_t* bus, uint8_t* rx_buf, size_t rx_buf_size)
+    {
+        if (!rx_buf) return ESP_ERR_INVALID_ARG;
+        SimBus* sim = from(bus);
+        for (size_t i = 0; i < rx_buf_size; i++) {
+            uint8_t value = 0;
+            for (int b = 0; b < 8; b++) value |= sim->slot(1) << b;
+            rx_buf[i] = value;
+        }
+        return ESP_OK;
+    }
+
+    esp_err_t SimBus::write_bit(onewire_bus_t* bus, uint8_t tx_bit)
+    {
+        from(bus)->slot(tx_bit ? 1 : 0);
+        return ESP_OK;
+    }
+
+    esp_err_t SimBus::read_bit(onewire_bus_t* bus, uint8_t* rx_bit)
+    {
+        if (!rx_bit) return ESP_ERR_INVALID_ARG;
+        *rx_bit = from(bus)->slot(1);
+        return ESP_OK;
+    }
+
+    esp_err_t SimBus::del(onewire_bus_t* bus)
+    {
+        (void)bus; // storage is owned by the caller
+        return ESP_OK;
+    }
+} // namespace ds18b20
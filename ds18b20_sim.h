@@ -0,0 +1,161 @@
+/**
+ * @file ds18b20_sim.h
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Simulated 1-Wire bus with virtual DS18B20 devices.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "ds18b20.h"
+#include "onewire_bus_interface.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ds18b20
+{
+    /**
+     * @brief Time source of the simulator. On the target it is esp_timer and the ROM busy-wait. A host build
+     * (no ESP_PLATFORM) gets a virtual clock that moves only when delay_us() is called, so the host port
+     * of esp_timer_get_time() and vTaskDelay() has to read and advance it too (see examples/benchmark/host).
+     */
+    namespace sim_clock
+    {
+        int64_t now_us(); /*!< current time, us */
+        void delay_us(uint32_t us); /*!< wait, or advance the virtual clock, for us */
+    } // namespace sim_clock
+
+    typedef struct {
+        onewire_device_address_t address; /*!< ROM number, see SimBus::make_address() */
+        int16_t temperature; /*!< temperature the next conversion measures, 1/16 degrees C, can be changed at any time */
+        int8_t th; /*!< EEPROM high alarm threshold, loaded at power-on */
+        int8_t tl; /*!< EEPROM low alarm threshold, loaded at power-on */
+        resolution_t resolution; /*!< EEPROM resolution, loaded at power-on, ignored for a DS18S20 */
+        bool parasite; /*!< parasite-powered, Read Power Supply answers 0 */
+        bool present; /*!< connected to the bus, can be changed at any time to simulate hot-plug */
+        struct {
+            uint8_t scratchpad[9]; /*!< scratchpad, CRC byte is computed on read */
+            int64_t busy_until_us; /*!< sim_clock time the running conversion or EEPROM write finishes */
+            bool converting; /*!< temperature registers are updated when the conversion finishes */
+            bool active; /*!< selected by the current ROM command */
+            uint8_t output[9]; /*!< data being read by the master */
+            uint8_t output_size; /*!< bytes in output */
+        } state; /*!< emulator state, initialized by SimBus */
+    } sim_device_t;
+
+    typedef struct {
+        uint32_t conversion_scale_pct; /*!< conversion time relative to the datasheet maximum, real parts finish early */
+        uint32_t bit_error_ppm; /*!< probability of a corrupted read slot, parts per million, to exercise CRC handling */
+        uint32_t seed; /*!< bit error generator seed */
+        bool realtime; /*!< delay every primitive for its modeled duration, so that esp_timer measurements match a real bus */
+    } sim_config_t;
+
+#define DS18B20_SIM_DEFAULT_CONFIG() { \
+        .conversion_scale_pct = 100, \
+        .bit_error_ppm = 0, \
+        .seed = 1, \
+        .realtime = false, \
+    }
+
+    /**
+     * @brief 1-wire bus backend that emulates DS18B20 (and DS18S20, by family code) devices at the time slot level: ROM commands including
+     * search and alarm search, wired-AND of several devices driving the line, conversion time per resolution,
+     * power-on scratchpad, EEPROM, Read Power Supply and random read slot corruption.
+     * Bus time is modeled with standard speed slot lengths, conversions run on the sim_clock (esp_timer on the target).
+     * Device storage is owned by the caller. Not thread safe, like a real bus.
+     */
+    class SimBus
+    {
+    public:
+        /**
+         * @brief Create a simulated bus, devices are powered on
+         *
+         * @param[in] devices Virtual devices, address, temperature, EEPROM and power fields have to be set
+         * @param[in] count Number of devices
+         * @param[in] config Simulation parameters
+         */
+        SimBus(sim_device_t* devices, size_t count, const sim_config_t& config);
+
+        /**
+         * @brief Get the handle to use with the library and the onewire_bus API
+         *
+         * @return 1-wire handle, valid while the simulated bus exists
+         */
+        onewire_bus_handle_t handle() { return &base; }
+
+        /**
+         * @brief Power-cycle a device: scratchpad is reloaded from EEPROM and reads 85 degrees C
+         *
+         * @param[in] index Index of the device
+         */
+        void power_on(size_t index);
+
+        /**
+         * @brief Build a valid DS18B20 ROM number
+         *
+         * @param[in] serial 48-bit serial number
+         * @param[in] family Family code, a DS18S20 is emulated with its own scratchpad layout and fixed conversion time
+         * @return ROM number with family code and CRC
+         */
+        static onewire_device_address_t make_address(uint64_t serial, uint8_t family = FAMILY_DS18B20);
+
+        uint64_t bus_time_us() const { return time_us; } /*!< modeled time the bus was busy */
+        uint32_t bit_errors() const { return corrupted; } /*!< read slots corrupted so far */
+
+    private:
+        typedef enum {
+            PHASE_IDLE, /*!< waiting for reset */
+            PHASE_ROM_COMMAND,
+            PHASE_MATCH_ROM,
+            PHASE_SEARCH_ROM,
+            PHASE_FUNCTION_COMMAND,
+            PHASE_WRITE_SCRATCHPAD,
+            PHASE_OUTPUT, /*!< active devices output their data */
+            PHASE_POWER_SUPPLY, /*!< parasite-powered active devices pull read slots low */
+            PHASE_BUSY, /*!< active devices pull read slots low while converting or writing EEPROM */
+        } phase_t;
+
+        onewire_bus_t base; // must stay the first member, handles are cast back to SimBus
+        sim_device_t* devices;
+        size_t count;
+        sim_config_t config;
+        phase_t phase;
+        uint32_t bit; /*!< bit number within the current phase */
+        uint8_t shift; /*!< bits received by the current phase */
+        uint64_t time_us;
+        uint32_t corrupted;
+        uint32_t noise;
+
+        uint8_t slot(uint8_t master);
+        uint8_t drive(sim_device_t& d, int64_t now) const;
+        void sample(uint8_t line, int64_t now);
+        void command(uint8_t cmd, int64_t now);
+        void update(sim_device_t& d, int64_t now);
+        void elapse(uint32_t us);
+        bool alarmed(const sim_device_t& d) const;
+
+        static SimBus* from(onewire_bus_t* bus) { return reinterpret_cast<SimBus*>(bus); }
+        static esp_err_t reset(onewire_bus_t* bus);
+        static esp_err_t write_bytes(onewire_bus_t* bus, const uint8_t* tx_data, uint8_t tx_data_size);
+        static esp_err_t read_bytes(onewire_bus_t* bus, uint8_t* rx_buf, size_t rx_buf_size);
+        static esp_err_t write_bit(onewire_bus_t* bus, uint8_t tx_bit);
+        static esp_err_t read_bit(onewire_bus_t* bus, uint8_t* rx_bit);
+        static esp_err_t del(onewire_bus_t* bus);
+    };
+} // namespace ds18b20
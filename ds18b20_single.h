@@ -0,0 +1,145 @@
+/**
+ * @file ds18b20_single.h
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Compile-time specialized access to the only DS18B20 on a bus.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "ds18b20.h"
+#include "onewire_bus.h"
+#include "onewire_cmd.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <stdint.h>
+
+namespace ds18b20
+{
+    /**
+     * @brief The only DS18B20 on a bus, addressed with SKIP ROM, at a resolution fixed at compile time.
+     * Command frames, conversion wait and resolution mask are constants and every call is inlined, there are
+     * no argument checks and no logging. Transactions go straight to the onewire_bus API, so they don't take the
+     * bus lock (see enable_bus_lock()) and are not counted in get_stats(). The device has to be externally powered
+     * (no strong pull-up is used).
+     *
+     * @tparam Resolution Resolution the device is configured to by init()
+     */
+    template <resolution_t Resolution = RESOLUTION_12B>
+    class Single
+    {
+        static_assert(Resolution == RESOLUTION_9B || Resolution == RESOLUTION_10B ||
+                      Resolution == RESOLUTION_11B || Resolution == RESOLUTION_12B, "invalid resolution");
+
+    public:
+        static constexpr uint32_t conversion_time_us = 750000 >> (3 - ((Resolution >> 5) & 0x03)); /*!< datasheet maximum */
+        static constexpr uint8_t lsb_mask = static_cast<uint8_t>(~(0x07 >> ((Resolution >> 5) & 0x03))); /*!< bits defined at this resolution */
+
+        /**
+         * @brief Wrap a bus with a single DS18B20, does not touch the bus
+         *
+         * @param[in] handle 1-wire handle, must not be NULL
+         */
+        explicit Single(onewire_bus_handle_t handle) : handle(handle) {}
+
+        /**
+         * @brief Write the resolution to the scratchpad, once before sampling. TH and TL (alarm thresholds or a
+         * stored calibration offset) are read back first and kept.
+         *
+         * @return See ds18b20::read_config(), ds18b20::set_config()
+         */
+        esp_err_t init()
+        {
+            config_t config;
+            esp_err_t err = read_config(handle, NULL, &config); // the only device, so SKIP ROM reads it back
+            if (err != ESP_OK) return err;
+            config.resolution = Resolution;
+            return set_config(handle, NULL, &config);
+        }
+
+        /**
+         * @brief Start a temperature conversion
+         *
+         * @return See onewire_bus_reset(), onewire_bus_write_bytes()
+         */
+        inline esp_err_t trigger()
+        {
+            static constexpr uint8_t frame[] = { ONEWIRE_CMD_SKIP_ROM, cmd_convert_temp };
+            esp_err_t err = onewire_bus_reset(handle);
+            if (err != ESP_OK) return err;
+            return onewire_bus_write_bytes(handle, frame, sizeof(frame));
+        }
+
+        /**
+         * @brief Read the result of the last conversion
+         *
+         * @tparam Length READ_FULL for a CRC-checked read, READ_TEMPERATURE to read only the temperature registers
+         * @param[out] temperature 1/16 degrees C, bits undefined at the resolution are cleared
+         * @return
+         *         - ESP_OK                Temperature read.
+         *         - ESP_ERR_INVALID_CRC   CRC check failed (READ_FULL only).
+         *         - Otherwise see onewire_bus_reset(), onewire_bus_write_bytes(), onewire_bus_read_bytes().
+         */
+        template <read_length_t Length = READ_FULL>
+        inline esp_err_t read_raw(int16_t* temperature)
+        {
+            static_assert(Length == READ_FULL || Length == READ_TEMPERATURE, "the configuration register is known");
+            static constexpr uint8_t frame[] = { ONEWIRE_CMD_SKIP_ROM, cmd_read_scratchpad };
+            uint8_t scratchpad[Length];
+            esp_err_t err = onewire_bus_reset(handle);
+            if (err != ESP_OK) return err;
+            err = onewire_bus_write_bytes(handle, frame, sizeof(frame));
+            if (err != ESP_OK) return err;
+            // a shorter read is terminated by the reset that starts the next transaction
+            err = onewire_bus_read_bytes(handle, scratchpad, sizeof(scratchpad));
+            if (err != ESP_OK) return err;
+            if (Length == READ_FULL && crc8(scratchpad, 8) != scratchpad[Length - 1]) return ESP_ERR_INVALID_CRC;
+            *temperature = static_cast<int16_t>((static_cast<uint16_t>(scratchpad[1]) << 8) | (scratchpad[0] & lsb_mask));
+            return ESP_OK;
+        }
+
+        /**
+         * @brief Convert, wait the conversion time and read the result
+         *
+         * @tparam Length See read_raw()
+         * @param[out] temperature 1/16 degrees C
+         * @return See trigger(), read_raw()
+         */
+        template <read_length_t Length = READ_FULL>
+        inline esp_err_t measure(int16_t* temperature)
+        {
+            esp_err_t err = trigger();
+            if (err != ESP_OK) return err;
+            vTaskDelay(conversion_ticks);
+            return read_raw<Length>(temperature);
+        }
+
+        onewire_bus_handle_t bus() const { return handle; }
+
+    private:
+        static constexpr uint8_t cmd_convert_temp = 0x44;
+        static constexpr uint8_t cmd_read_scratchpad = 0xBE;
+        // rounded up, plus the partial tick vTaskDelay() starts in
+        static constexpr TickType_t conversion_ticks =
+            static_cast<TickType_t>((static_cast<uint64_t>(conversion_time_us) * configTICK_RATE_HZ + 999999) / 1000000) + 1;
+
+        onewire_bus_handle_t handle;
+    };
+} // namespace ds18b20
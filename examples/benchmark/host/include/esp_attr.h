@@ -0,0 +1,6 @@
+// Host port: memory placement attributes have no meaning on the host
+#pragma once
+
+#define DRAM_ATTR
+#define IRAM_ATTR
+#define RTC_DATA_ATTR
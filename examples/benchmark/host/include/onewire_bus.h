@@ -0,0 +1,20 @@
+// Host port: onewire_bus component API
+#pragma once
+
+#include "esp_err.h"
+#include "onewire_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t onewire_bus_del(onewire_bus_handle_t bus);
+esp_err_t onewire_bus_reset(onewire_bus_handle_t bus);
+esp_err_t onewire_bus_write_bytes(onewire_bus_handle_t bus, const uint8_t* tx_data, uint8_t tx_data_size);
+esp_err_t onewire_bus_read_bytes(onewire_bus_handle_t bus, uint8_t* rx_buf, size_t rx_buf_size);
+esp_err_t onewire_bus_write_bit(onewire_bus_handle_t bus, uint8_t tx_bit);
+esp_err_t onewire_bus_read_bit(onewire_bus_handle_t bus, uint8_t* rx_bit);
+
+#ifdef __cplusplus
+}
+#endif
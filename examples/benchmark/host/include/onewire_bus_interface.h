@@ -0,0 +1,16 @@
+// Host port: onewire_bus driver interface, implemented by SimBus
+#pragma once
+
+#include "esp_err.h"
+#include "onewire_types.h"
+
+typedef struct onewire_bus_t onewire_bus_t;
+
+struct onewire_bus_t {
+    esp_err_t (*reset)(onewire_bus_t* bus);
+    esp_err_t (*write_bytes)(onewire_bus_t* bus, const uint8_t* tx_data, uint8_t tx_data_size);
+    esp_err_t (*read_bytes)(onewire_bus_t* bus, uint8_t* rx_buf, size_t rx_buf_size);
+    esp_err_t (*write_bit)(onewire_bus_t* bus, uint8_t tx_bit);
+    esp_err_t (*read_bit)(onewire_bus_t* bus, uint8_t* rx_bit);
+    esp_err_t (*del)(onewire_bus_t* bus);
+};
@@ -0,0 +1,8 @@
+// Host port: onewire_bus component ROM commands
+#pragma once
+
+#define ONEWIRE_CMD_SEARCH_NORMAL 0xF0
+#define ONEWIRE_CMD_MATCH_ROM 0x55
+#define ONEWIRE_CMD_SKIP_ROM 0xCC
+#define ONEWIRE_CMD_SEARCH_ALARM 0xEC
+#define ONEWIRE_CMD_READ_POWER_SUPPLY 0xB4
@@ -0,0 +1,9 @@
+// Host port: onewire_bus component types
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct onewire_bus_t* onewire_bus_handle_t;
+typedef uint64_t onewire_device_address_t;
+typedef struct onewire_device_iter_t* onewire_device_iter_handle_t;
@@ -0,0 +1,6 @@
+// Host port: configuration of the benchmark build, see sdkconfig.defaults of the target build
+#pragma once
+
+#define CONFIG_DS18B20_MAX_BUSES 4
+#define CONFIG_DS18B20_SIM 1
+#define CONFIG_DS18B20_CRC8_TABLE 1
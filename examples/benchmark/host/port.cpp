@@ -0,0 +1,164 @@
+/**
+ * @file port.cpp
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Host port of the ESP-IDF and onewire_bus API used by the library, on the simulator's virtual clock.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ds18b20_sim.h"
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "onewire_bus.h"
+#include "onewire_bus_interface.h"
+#include "onewire_crc.h"
+
+/// @brief Advance the virtual clock by whole ticks
+/// @param ticks Number of ticks
+static void elapse_ticks(TickType_t ticks)
+{
+    ds18b20::sim_clock::delay_us(ticks * portTICK_PERIOD_MS * 1000);
+}
+
+const char* esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    default: return "ERROR";
+    }
+}
+
+extern "C" {
+
+int64_t esp_timer_get_time(void)
+{
+    return ds18b20::sim_clock::now_us();
+}
+
+esp_err_t onewire_bus_del(onewire_bus_handle_t bus)
+{
+    return bus->del(bus);
+}
+
+esp_err_t onewire_bus_reset(onewire_bus_handle_t bus)
+{
+    return bus->reset(bus);
+}
+
+esp_err_t onewire_bus_write_bytes(onewire_bus_handle_t bus, const uint8_t* tx_data, uint8_t tx_data_size)
+{
+    return bus->write_bytes(bus, tx_data, tx_data_size);
+}
+
+esp_err_t onewire_bus_read_bytes(onewire_bus_handle_t bus, uint8_t* rx_buf, size_t rx_buf_size)
+{
+    return bus->read_bytes(bus, rx_buf, rx_buf_size);
+}
+
+esp_err_t onewire_bus_write_bit(onewire_bus_handle_t bus, uint8_t tx_bit)
+{
+    return bus->write_bit(bus, tx_bit);
+}
+
+esp_err_t onewire_bus_read_bit(onewire_bus_handle_t bus, uint8_t* rx_bit)
+{
+    return bus->read_bit(bus, rx_bit);
+}
+
+uint8_t onewire_crc8(uint8_t init_crc, uint8_t* input, size_t input_size)
+{
+    uint8_t crc = init_crc;
+    for (size_t i = 0; i < input_size; i++) {
+        uint8_t byte = input[i];
+        for (int j = 0; j < 8; j++) {
+            uint8_t x = (byte ^ crc) & 0x01;
+            crc >>= 1;
+            if (x) crc ^= 0x8C;
+            byte >>= 1;
+        }
+    }
+    return crc;
+}
+
+} // extern "C"
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*, BaseType_t)
+{
+    return pdFAIL;
+}
+
+void vTaskDelete(TaskHandle_t)
+{
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    elapse_ticks(ticks);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return static_cast<TickType_t>(ds18b20::sim_clock::now_us() / (portTICK_PERIOD_MS * 1000));
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t ticks_to_wait)
+{
+    elapse_ticks(ticks_to_wait); // nobody else can notify
+    return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t)
+{
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return NULL;
+}
+
+BaseType_t xQueueSend(QueueHandle_t, const void*, TickType_t)
+{
+    return pdFAIL;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutexStatic(StaticSemaphore_t* buffer)
+{
+    return reinterpret_cast<SemaphoreHandle_t>(buffer);
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t, TickType_t)
+{
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t)
+{
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t)
+{
+}
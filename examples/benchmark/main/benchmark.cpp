@@ -0,0 +1,330 @@
+/**
+ * @file benchmark.cpp
+ * @author Kutukov Pavel (kutukovps@my.msu.ru)
+ * @brief Sampling strategy benchmark on a simulated 1-Wire bus.
+ * @version 1
+ * @date 2023-12-02
+ *
+ * @copyright This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ds18b20.h"
+#include "ds18b20_poller.h"
+#include "ds18b20_registry.h"
+#include "ds18b20_sim.h"
+#include "ds18b20_single.h"
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <algorithm>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef BENCH_DEVICES
+#define BENCH_DEVICES 8 // virtual devices on the bus
+#endif
+
+#ifndef BENCH_CYCLES
+#define BENCH_CYCLES 4 // samples of every device per strategy
+#endif
+
+#ifndef BENCH_CONVERSION_PCT
+#define BENCH_CONVERSION_PCT 75 // real parts finish well before the datasheet maximum
+#endif
+
+#ifndef BENCH_BIT_ERROR_PPM
+#define BENCH_BIT_ERROR_PPM 0
+#endif
+
+#define BENCH_RESOLUTION ds18b20::RESOLUTION_12B
+#define BENCH_SAMPLES (BENCH_DEVICES * BENCH_CYCLES)
+
+// The throughput floors below are for the default setup only, other ones just skip the check
+#define BENCH_CHECK_FLOORS (BENCH_DEVICES == 8 && BENCH_CONVERSION_PCT == 75 && BENCH_BIT_ERROR_PPM == 0)
+
+using namespace ds18b20;
+
+typedef struct {
+    uint32_t samples; /*!< successful reads */
+    uint32_t errors; /*!< failed reads */
+    uint32_t wrong; /*!< successful reads that decoded to something else than the simulated temperature */
+    int64_t elapsed_us; /*!< wall time of the whole run */
+    uint64_t bus_us; /*!< modeled time the bus was busy */
+    uint32_t latency_us[BENCH_SAMPLES]; /*!< conversion start to availability of every successful reading */
+} run_t;
+
+static sim_device_t devices[BENCH_DEVICES];
+static onewire_device_address_t roms[BENCH_DEVICES];
+static device_t table_storage[BENCH_DEVICES];
+static reading_t readings[BENCH_DEVICES];
+static float temperatures[BENCH_DEVICES];
+static esp_err_t status[BENCH_DEVICES];
+static run_t run;
+static uint32_t failures;
+
+/// @brief Wait for a conversion the way an application without completion polling would: whole ticks, rounded up
+/// @param us Conversion time
+static void wait_us(uint32_t us)
+{
+    const uint32_t tick_us = portTICK_PERIOD_MS * 1000;
+    vTaskDelay((us + tick_us - 1) / tick_us);
+}
+
+/// @brief Simulated temperature of a device
+/// @param rom ROM number
+/// @return Temperature, 1/16 degrees C, INT16_MIN for an unknown ROM
+static int16_t expected_raw(const onewire_device_address_t& rom)
+{
+    for (size_t i = 0; i < BENCH_DEVICES; i++) {
+        if (devices[i].address == rom) return devices[i].temperature;
+    }
+    return INT16_MIN;
+}
+
+/// @brief Account for one read
+/// @param status Result of the read
+/// @param convert_us Time the conversion started
+/// @param read_us Time the read completed
+/// @param correct The decoded temperature matches the simulated one, not checked on failed reads
+static void add_sample(esp_err_t status, int64_t convert_us, int64_t read_us, bool correct)
+{
+    if (status != ESP_OK) {
+        run.errors++;
+        return;
+    }
+    if (!correct) run.wrong++;
+    if (run.samples < BENCH_SAMPLES) run.latency_us[run.samples] = static_cast<uint32_t>(read_us - convert_us);
+    run.samples++;
+}
+
+/// @brief Serial: addressed conversion of one device, wait, read it, next device
+static void bench_serial(onewire_bus_handle_t handle)
+{
+    const uint32_t conversion_us = get_conversion_time_us(BENCH_RESOLUTION);
+    for (int cycle = 0; cycle < BENCH_CYCLES; cycle++) {
+        for (size_t i = 0; i < BENCH_DEVICES; i++) {
+            int16_t raw = 0;
+            esp_err_t err = trigger_temperature_conversion(handle, &roms[i]);
+            int64_t convert_us = esp_timer_get_time();
+            if (err == ESP_OK) {
+                wait_us(conversion_us);
+                err = get_temperature_raw(handle, &roms[i], &raw);
+            }
+            add_sample(err, convert_us, esp_timer_get_time(), raw == devices[i].temperature);
+        }
+    }
+}
+
+/// @brief Batched: broadcast conversion, worst-case wait, get_temperatures() for the whole bus
+static void bench_batched(onewire_bus_handle_t handle)
+{
+    const uint32_t conversion_us = get_conversion_time_us(BENCH_RESOLUTION);
+    for (int cycle = 0; cycle < BENCH_CYCLES; cycle++) {
+        if (trigger_temperature_conversion(handle, NULL) != ESP_OK) {
+            run.errors += BENCH_DEVICES;
+            continue;
+        }
+        int64_t convert_us = esp_timer_get_time();
+        wait_us(conversion_us);
+        get_temperatures(handle, roms, BENCH_DEVICES, temperatures, status);
+        int64_t read_us = esp_timer_get_time(); // the batch is available as a whole
+        for (size_t i = 0; i < BENCH_DEVICES; i++) {
+            add_sample(status[i], convert_us, read_us, temperatures[i] == devices[i].temperature / 16.0f);
+        }
+    }
+}
+
+/// @brief Poller cycles of a device table, a reading is available when its cycle ends
+/// @param table Device table of the bus
+/// @param config Poller configuration
+static void bench_poller(DeviceTable& table, const poller_config_t& config)
+{
+    // Reads without CRC can't tell an injected bit error from a temperature change
+    const bool check = config.read_policy.length == READ_FULL || BENCH_BIT_ERROR_PPM == 0;
+    Poller poller(table, readings, config);
+    for (int cycle = 0; cycle < BENCH_CYCLES; cycle++) {
+        int64_t start_us = esp_timer_get_time();
+        poller.run_cycle();
+        int64_t end_us = esp_timer_get_time();
+        for (size_t i = 0; i < poller.result_count(); i++) {
+            const reading_t& reading = readings[i];
+            bool correct = !check || reading.raw == expected_raw(table[reading.index].address);
+            add_sample(reading.status, start_us, end_us, correct);
+        }
+    }
+}
+
+/// @brief Broadcast: Poller with its defaults, one SKIP ROM conversion and full CRC-checked reads per cycle
+static void bench_broadcast(DeviceTable& table)
+{
+    poller_config_t config = DS18B20_POLLER_DEFAULT_CONFIG();
+    bench_poller(table, config);
+}
+
+/// @brief Fast read: Poller that polls for conversion completion and reads only the temperature registers
+static void bench_fast_read(DeviceTable& table)
+{
+    poller_config_t config = DS18B20_POLLER_DEFAULT_CONFIG();
+    config.poll_completion = true;
+    config.read_policy.length = READ_TEMPERATURE;
+    bench_poller(table, config);
+}
+
+/// @brief Latency percentile of the current run
+/// @param pct Percentile, 0 to 100
+/// @return Latency, us, 0 without samples
+static uint32_t percentile(uint32_t pct)
+{
+    size_t n = std::min<size_t>(run.samples, BENCH_SAMPLES);
+    if (n == 0) return 0;
+    return run.latency_us[(n - 1) * pct / 100];
+}
+
+/// @brief Print one result line and check it
+/// @param name Strategy name
+/// @param floor_x10 Lowest acceptable samples/s of the default setup, x10
+static void report(const char* name, uint32_t floor_x10)
+{
+    std::sort(run.latency_us, run.latency_us + std::min<size_t>(run.samples, BENCH_SAMPLES));
+    uint32_t per_s_x10 = run.elapsed_us > 0 ? static_cast<uint32_t>(run.samples * 10000000LL / run.elapsed_us) : 0;
+    uint32_t busy_pct = run.elapsed_us > 0 ? static_cast<uint32_t>(run.bus_us * 100 / run.elapsed_us) : 0;
+    printf("%-10s %7" PRIu32 ".%" PRIu32 " %8.1f %8.1f %8.1f %8.1f %5" PRIu32 "%% %6" PRIu32 " %6" PRIu32 "\n", name,
+        per_s_x10 / 10, per_s_x10 % 10, percentile(50) / 1000.0, percentile(90) / 1000.0, percentile(99) / 1000.0,
+        percentile(100) / 1000.0, busy_pct, run.errors, run.wrong);
+
+    if (run.wrong != 0) {
+        printf("FAIL %s: %" PRIu32 " readings don't match the simulated temperatures\n", name, run.wrong);
+        failures++;
+    }
+    if (BENCH_BIT_ERROR_PPM == 0 && run.errors != 0) {
+        printf("FAIL %s: %" PRIu32 " errors on an error-free bus\n", name, run.errors);
+        failures++;
+    }
+    if (BENCH_CHECK_FLOORS && per_s_x10 < floor_x10) {
+        printf("FAIL %s: %" PRIu32 ".%" PRIu32 " samples/s, below the floor of %" PRIu32 ".%" PRIu32 "\n", name,
+            per_s_x10 / 10, per_s_x10 % 10, floor_x10 / 10, floor_x10 % 10);
+        failures++;
+    }
+}
+
+/// @brief Single: the only device of a bus through ds18b20::Single, each measure() checked against get_temperature_raw()
+/// @tparam Resolution Resolution of the Single instance
+/// @param floor_x10 Lowest acceptable samples/s of the default setup, x10
+template <resolution_t Resolution>
+static void bench_single(uint32_t floor_x10)
+{
+    sim_device_t device = devices[0];
+    device.temperature = 20 * 16 + 7; // fraction bits that the lower resolutions clear
+    device.resolution = RESOLUTION_12B; // init() has to change it
+    sim_config_t sim_config = DS18B20_SIM_DEFAULT_CONFIG();
+    sim_config.conversion_scale_pct = BENCH_CONVERSION_PCT;
+    sim_config.bit_error_ppm = BENCH_BIT_ERROR_PPM;
+    sim_config.realtime = true;
+    SimBus sim(&device, 1, sim_config);
+    Single<Resolution> single(sim.handle());
+    const int16_t expected = static_cast<int16_t>(device.temperature & ~(0x07 >> ((Resolution >> 5) & 0x03)));
+
+    run = {};
+    uint64_t bus_start = sim.bus_time_us();
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = single.init();
+    if (err != ESP_OK) run.errors += BENCH_CYCLES;
+    for (int cycle = 0; err == ESP_OK && cycle < BENCH_CYCLES; cycle++) {
+        int16_t raw = 0;
+        int16_t reference = 0;
+        int64_t convert_us = esp_timer_get_time();
+        esp_err_t status = single.measure(&raw);
+        int64_t read_us = esp_timer_get_time();
+        // the library read of the same scratchpad, and the temperature-only read of the template
+        bool correct = raw == expected;
+        if (status == ESP_OK && get_temperature_raw(sim.handle(), NULL, &reference) == ESP_OK) correct &= reference == raw;
+        if (status == ESP_OK && single.template read_raw<READ_TEMPERATURE>(&reference) == ESP_OK) {
+            correct &= BENCH_BIT_ERROR_PPM != 0 || reference == raw;
+        }
+        add_sample(status, convert_us, read_us, correct);
+    }
+    run.elapsed_us = esp_timer_get_time() - start;
+    run.bus_us = sim.bus_time_us() - bus_start;
+    report(Resolution == RESOLUTION_12B ? "single-12b" : "single-9b", floor_x10);
+}
+
+extern "C" void app_main(void)
+{
+    for (size_t i = 0; i < BENCH_DEVICES; i++) {
+        devices[i].address = SimBus::make_address(0x1000 + i);
+        devices[i].temperature = static_cast<int16_t>(20 * 16 + i);
+        devices[i].th = 125;
+        devices[i].tl = -55;
+        devices[i].resolution = BENCH_RESOLUTION;
+        devices[i].parasite = false;
+        devices[i].present = true;
+        roms[i] = devices[i].address;
+    }
+    sim_config_t sim_config = DS18B20_SIM_DEFAULT_CONFIG();
+    sim_config.conversion_scale_pct = BENCH_CONVERSION_PCT;
+    sim_config.bit_error_ppm = BENCH_BIT_ERROR_PPM;
+    sim_config.realtime = true;
+    SimBus sim(devices, BENCH_DEVICES, sim_config);
+
+    DeviceTable table(sim.handle(), table_storage, BENCH_DEVICES);
+    for (int pass = 0; pass < 5 && table.size() < BENCH_DEVICES; pass++) table.scan(); // searches can hit bit errors too
+    if (table.size() == 0) {
+        printf("FAIL device table scan\n");
+        failures++;
+        return;
+    }
+
+    printf("%d devices (%u in the poller table), %d samples each, conversion at %d%% of the datasheet time\n", BENCH_DEVICES,
+        static_cast<unsigned>(table.size()), BENCH_CYCLES, BENCH_CONVERSION_PCT);
+    printf("%-10s %9s %8s %8s %8s %8s %6s %6s %6s\n", "strategy", "samples/s", "p50 ms", "p90 ms", "p99 ms", "max ms", "bus",
+        "errors", "wrong");
+
+    // Floors sit about 15% below the rates of the default setup, realtime simulation makes them hold on the target too
+    static const struct {
+        const char* name;
+        void (*bus)(onewire_bus_handle_t handle);
+        void (*poller)(DeviceTable& table);
+        uint32_t floor_x10; /*!< samples/s x10 */
+    } strategies[] = {
+        { "serial", bench_serial, NULL, 11 },
+        { "batched", bench_batched, NULL, 80 },
+        { "broadcast", NULL, bench_broadcast, 80 },
+        { "fast-read", NULL, bench_fast_read, 108 },
+    };
+    for (const auto& strategy : strategies) {
+        run = {};
+        uint64_t bus_start = sim.bus_time_us();
+        int64_t start = esp_timer_get_time();
+        if (strategy.bus) strategy.bus(sim.handle());
+        else strategy.poller(table);
+        run.elapsed_us = esp_timer_get_time() - start;
+        run.bus_us = sim.bus_time_us() - bus_start;
+        report(strategy.name, strategy.floor_x10);
+    }
+    bench_single<RESOLUTION_12B>(10);
+    bench_single<RESOLUTION_9B>(65);
+    printf(failures ? "FAILED\n" : "PASSED\n");
+}
+
+#ifndef ESP_PLATFORM
+int main()
+{
+    app_main();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif